@@ -0,0 +1,91 @@
+#!/usr/bin/env bash
+
+# Startup-latency benchmark: runs triag many times on a tiny input and reports
+# per-invocation wall time, which is dominated by process start-up and
+# dynamic loading rather than by the computation itself.
+
+set -eo pipefail
+
+script_dir="$(cd "$(dirname "${BASH_SOURCE[0]}")" && pwd)"
+project_root="$(dirname "$script_dir")"
+
+current_time_us() {
+    echo $(($(date +%s%N) / 1000))
+}
+
+triag_bin=""
+runs=200
+input_file="$project_root/end2end/tests/test1.txt"
+max_ms=""
+
+while [[ $# -gt 0 ]]; do
+    case "$1" in
+        -b)
+            triag_bin="$2"
+            shift 2
+            ;;
+        -n)
+            runs="$2"
+            shift 2
+            ;;
+        -i)
+            input_file="$2"
+            shift 2
+            ;;
+        -t)
+            max_ms="$2"
+            shift 2
+            ;;
+        *)
+            echo "Unknown option: $1"
+            echo "Usage: startup_latency.sh [-b triag] [-n runs] [-i input] [-t max_median_ms]"
+            exit 1
+            ;;
+    esac
+done
+
+[ -z "$triag_bin" ] && triag_bin="${TRIAG_BIN:-$project_root/build/triag}"
+
+if [ ! -f "$triag_bin" ]; then
+    echo "ERROR: 'triag' binary not found at: $triag_bin"
+    exit 1
+fi
+
+if [ ! -f "$input_file" ]; then
+    echo "ERROR: input not found at: $input_file"
+    exit 1
+fi
+
+# Shared libraries the binary pulls in at start-up.
+needed=$(ldd "$triag_bin" 2>/dev/null | grep -c "=>" || true)
+echo "binary:  $triag_bin"
+echo "needed:  $needed shared libraries"
+ldd "$triag_bin" 2>/dev/null | grep -iE "libGL|glfw|GLEW|X11|Xrandr|Xi\." \
+    && echo "WARNING: compute binary links graphics libraries"
+
+# Warm up the page cache.
+"$triag_bin" < "$input_file" > /dev/null
+
+timings=()
+for ((i = 0; i < runs; ++i)); do
+    start_time=$(current_time_us)
+    "$triag_bin" < "$input_file" > /dev/null
+    timings+=($(( $(current_time_us) - start_time )))
+done
+
+sorted=($(printf "%s\n" "${timings[@]}" | sort -n))
+total=0
+for t in "${timings[@]}"; do
+    total=$((total + t))
+done
+
+median_us=${sorted[$((runs / 2))]}
+echo "runs:    $runs"
+echo "min:     $(awk "BEGIN { printf \"%.3f\", ${sorted[0]} / 1000 }") ms"
+echo "median:  $(awk "BEGIN { printf \"%.3f\", $median_us / 1000 }") ms"
+echo "mean:    $(awk "BEGIN { printf \"%.3f\", $total / $runs / 1000 }") ms"
+
+if [ -n "$max_ms" ] && awk "BEGIN { exit !($median_us / 1000 > $max_ms) }"; then
+    echo "FAILED: median start-up latency exceeds $max_ms ms"
+    exit 1
+fi
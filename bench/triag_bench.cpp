@@ -0,0 +1,442 @@
+#include <benchmark/benchmark.h>
+
+#include "compact_bvh.hpp"
+#include "generator.hpp"
+#include "input.hpp"
+#include "intersections.hpp"
+#include "perf_counters.hpp"
+
+#include <cstdlib>
+#include <optional>
+#include <random>
+#include <sstream>
+#include <string>
+
+// Micro- and macrobenchmarks of the intersection pipeline. Run with
+//   triag_bench --benchmark_format=json --benchmark_out=bench.json
+// to get machine-readable results; TRIAG_BENCH_MAX_N limits the size of the
+// macrobenchmark datasets (10^7 by default). Where perf_event_open is allowed
+// the microbenchmarks also report IPC and cache/branch misses per item.
+
+namespace {
+using namespace triangle;
+using PointTy = double;
+using TYPE = Triangle<PointTy>::TriangleType;
+
+constexpr size_t pool_size = 1024;
+
+// Adds hardware counter deltas over its lifetime to the benchmark counters.
+class HardwareCounters {
+  benchmark::State &state;
+  perf::Sample start = perf::read();
+
+public:
+  explicit HardwareCounters(benchmark::State &state) : state(state) {}
+
+  ~HardwareCounters() {
+    perf::Sample delta = perf::read() - start;
+    if (!delta.valid || state.iterations() == 0)
+      return;
+
+    double items = static_cast<double>(state.iterations());
+    state.counters["IPC"] = delta.ipc();
+    state.counters["cycles_per_item"] = delta.values[perf::CYCLES] / items;
+    state.counters["branch_misses_per_item"] =
+        delta.values[perf::BRANCH_MISSES] / items;
+    state.counters["cache_misses_per_item"] =
+        delta.values[perf::CACHE_MISSES] / items;
+  }
+};
+
+// Random shape of the requested type near the origin. Half of the shapes lie
+// in the plane z = 0, so that coplanar and crossing pairs show up too.
+Triangle<PointTy> random_shape(TYPE type, std::mt19937_64 &random) {
+  std::uniform_real_distribution<PointTy> coordinate(-1.0, 1.0);
+  bool flat = random() % 2 == 0;
+
+  auto point = [&]() {
+    return Point<PointTy>{coordinate(random), coordinate(random),
+                          flat ? 0.0 : coordinate(random)};
+  };
+
+  Point<PointTy> a = point();
+  Point<PointTy> b = point();
+
+  switch (type) {
+  case TYPE::POINT:
+    return Triangle<PointTy>(a, a, a);
+  case TYPE::LINE:
+    return Triangle<PointTy>(a, b, a);
+  default:
+    return Triangle<PointTy>(a, b, point());
+  }
+}
+
+std::vector<std::pair<Triangle<PointTy>, Triangle<PointTy>>>
+make_pair_pool(TYPE type1, TYPE type2) {
+  std::mt19937_64 random(42);
+  std::vector<std::pair<Triangle<PointTy>, Triangle<PointTy>>> pool;
+
+  while (pool.size() < pool_size) {
+    Triangle<PointTy> one = random_shape(type1, random);
+    Triangle<PointTy> two = random_shape(type2, random);
+    if (one.get_type() == type1 && two.get_type() == type2)
+      pool.emplace_back(one, two);
+  }
+
+  return pool;
+}
+
+template <Kernel K>
+void BM_CheckIntersection(benchmark::State &state, TYPE type1, TYPE type2) {
+  auto pool = make_pair_pool(type1, type2);
+  size_t index = 0;
+  size_t hits = 0;
+  HardwareCounters hardware(state);
+
+  for (auto _ : state) {
+    auto &[one, two] = pool[index++ % pool_size];
+    bool result = check_intersection<K>(one, two);
+    hits += result;
+    benchmark::DoNotOptimize(result);
+  }
+
+  state.SetItemsProcessed(state.iterations());
+  state.counters["hit_rate"] =
+      static_cast<double>(hits) / std::max<int64_t>(state.iterations(), 1);
+}
+
+void BM_PlaneConstruction(benchmark::State &state) {
+  auto pool = make_pair_pool(TYPE::TRIANGLE, TYPE::TRIANGLE);
+  size_t index = 0;
+  HardwareCounters hardware(state);
+
+  for (auto _ : state) {
+    const auto &trg = pool[index++ % pool_size].first;
+    Plane<PointTy> plane(trg.get_a(), trg.get_b(), trg.get_c());
+    benchmark::DoNotOptimize(plane);
+  }
+
+  state.SetItemsProcessed(state.iterations());
+}
+
+void BM_IntersectLineWithLine(benchmark::State &state) {
+  auto pool = make_pair_pool(TYPE::TRIANGLE, TYPE::TRIANGLE);
+  std::vector<std::pair<Line<PointTy>, Line<PointTy>>> lines;
+  for (const auto &[one, two] : pool) {
+    lines.push_back({Line<PointTy>{one.get_b() - one.get_a(), one.get_a()},
+                     Line<PointTy>{two.get_b() - two.get_a(), two.get_a()}});
+  }
+  size_t index = 0;
+  HardwareCounters hardware(state);
+
+  for (auto _ : state) {
+    const auto &[line1, line2] = lines[index++ % pool_size];
+    Point<PointTy> point = intersect_line_with_line(line1, line2);
+    benchmark::DoNotOptimize(point);
+  }
+
+  state.SetItemsProcessed(state.iterations());
+}
+
+void BM_PointInTriangle(benchmark::State &state) {
+  auto pool = make_pair_pool(TYPE::TRIANGLE, TYPE::POINT);
+  size_t index = 0;
+  HardwareCounters hardware(state);
+
+  for (auto _ : state) {
+    const auto &[trg, point] = pool[index++ % pool_size];
+    bool result = point_in_triangle(trg, point.get_a());
+    benchmark::DoNotOptimize(result);
+  }
+
+  state.SetItemsProcessed(state.iterations());
+}
+
+// The last generated dataset, reused while consecutive benchmarks ask for it.
+const std::vector<Triangle<PointTy>> &dataset(Distribution distribution,
+                                              size_t count) {
+  static std::vector<Triangle<PointTy>> triangles;
+  static Distribution cached_distribution;
+  static size_t cached_count = 0;
+
+  if (cached_count != count || cached_distribution != distribution) {
+    triangles.clear();
+    triangles.shrink_to_fit();
+    triangles = generate_triangles<PointTy>(distribution, count, 1);
+    cached_distribution = distribution;
+    cached_count = count;
+  }
+
+  return triangles;
+}
+
+std::string dataset_text(Distribution distribution, size_t count) {
+  TriangleGenerator generator(distribution, count, 1);
+  std::ostringstream out;
+  out.precision(9);
+  out << count << "\n";
+
+  for (size_t i = 0; i < count; ++i) {
+    for (double coordinate : generator.next())
+      out << coordinate << " ";
+    out << "\n";
+  }
+
+  return out.str();
+}
+
+void BM_Parse(benchmark::State &state, Distribution distribution) {
+  size_t count = state.range(0);
+  std::string text = dataset_text(distribution, count);
+
+  for (auto _ : state) {
+    std::istringstream in(text);
+    auto triangles = read_triangles<PointTy>(in);
+    benchmark::DoNotOptimize(triangles.data());
+  }
+
+  state.SetItemsProcessed(state.iterations() * count);
+  state.SetBytesProcessed(state.iterations() * text.size());
+}
+
+void BM_DivideTree(benchmark::State &state, Distribution distribution) {
+  size_t count = state.range(0);
+  const auto &triangles = dataset(distribution, count);
+  size_t cells = 0;
+
+  for (auto _ : state) {
+    Octotree<PointTy> octotree(triangles, calculate_octotree_depth(count));
+    octotree.divide_tree();
+    cells = octotree.get_cells().size();
+    benchmark::ClobberMemory();
+  }
+
+  state.SetItemsProcessed(state.iterations() * count);
+  state.counters["cells"] = cells;
+}
+
+template <Engine E, Kernel K>
+void BM_FullRun(benchmark::State &state, Distribution distribution) {
+  size_t count = state.range(0);
+  const auto &triangles = dataset(distribution, count);
+  size_t intersecting_num = 0;
+  SearchOptions options;
+  options.engine = E;
+  options.kernel = K;
+
+  for (auto _ : state) {
+    auto intersecting = find_intersecting(triangles, options);
+    intersecting_num = 0;
+    for (const auto &flag : intersecting)
+      intersecting_num += flag.load(std::memory_order_relaxed);
+  }
+
+  state.SetItemsProcessed(state.iterations() * count);
+  state.counters["intersecting"] = intersecting_num;
+}
+
+// Structures that answer queries against a fixed scene.
+enum class QueryTree { BVH8, COMPACT, LBVH, OCTOTREE };
+
+// Box or ray queries against a scene of the distribution, one per
+// iteration: the boxes of scene triangles, and segments through scene
+// triangles in random directions.
+template <QueryTree T, bool Ray>
+void BM_Query(benchmark::State &state, Distribution distribution) {
+  size_t count = state.range(0);
+  const auto &triangles = dataset(distribution, count);
+
+  std::mt19937_64 random(7);
+  std::normal_distribution<PointTy> normal;
+  std::vector<Box<PointTy>> boxes;
+  std::vector<std::pair<Point<PointTy>, Vector<PointTy>>> rays;
+  for (size_t k = 0; k < pool_size; ++k) {
+    const Triangle<PointTy> &trg = triangles[random() % count];
+    boxes.emplace_back(trg, 8 * epsilon_);
+    Vector<PointTy> direction{10 * normal(random), 10 * normal(random),
+                              10 * normal(random)};
+    Point<PointTy> a = trg.get_a();
+    rays.emplace_back(Point<PointTy>{a.x - direction.x / 2,
+                                     a.y - direction.y / 2,
+                                     a.z - direction.z / 2},
+                      direction);
+  }
+
+  auto ray_hits = [](const Box<PointTy> &box, const Point<PointTy> &origin,
+                     const Vector<PointTy> &direction) {
+    PointTy near = 0, far = 1;
+    const PointTy from[3] = {origin.x, origin.y, origin.z};
+    const PointTy along[3] = {direction.x, direction.y, direction.z};
+    for (int axis = 0; axis < 3; ++axis) {
+      PointTy one = (box.lower[axis] - from[axis]) / along[axis];
+      PointTy two = (box.upper[axis] - from[axis]) / along[axis];
+      near = std::max(near, std::min(one, two));
+      far = std::min(far, std::max(one, two));
+    }
+    return near <= far;
+  };
+
+  std::optional<BVH8<PointTy>> bvh8;
+  std::optional<CompactBVH<PointTy>> compact;
+  std::optional<LinearBVH<PointTy>> lbvh;
+  std::optional<Octotree<PointTy>> octotree;
+  if constexpr (T == QueryTree::BVH8) {
+    bvh8.emplace(triangles, 1);
+  } else if constexpr (T == QueryTree::COMPACT) {
+    compact.emplace(triangles, 1);
+  } else if constexpr (T == QueryTree::LBVH) {
+    lbvh.emplace(triangles, 1);
+  } else {
+    octotree.emplace(triangles, calculate_octotree_depth(count));
+    octotree->divide_tree();
+  }
+
+  size_t index = 0, hits = 0;
+  auto visit = [&](uint32_t) { ++hits; };
+  for (auto _ : state) {
+    size_t query = index++ % pool_size;
+    if constexpr (T == QueryTree::BVH8) {
+      if constexpr (Ray)
+        bvh8->for_each_ray_overlap(rays[query].first, rays[query].second, 0,
+                                   1, visit);
+      else
+        bvh8->for_each_box_overlap(boxes[query], visit);
+    } else if constexpr (T == QueryTree::COMPACT) {
+      compact->for_each_box_overlap(boxes[query], visit);
+    } else if constexpr (T == QueryTree::LBVH) {
+      // Depth-first over the binary nodes.
+      uint32_t stack[128];
+      size_t top = 0;
+      stack[top++] = 0;
+      while (top != 0) {
+        uint32_t node = stack[--top];
+        const Box<PointTy> &box = lbvh->get_box(node);
+        if (Ray ? !ray_hits(box, rays[query].first, rays[query].second)
+                : !box.overlaps(boxes[query]))
+          continue;
+        if (lbvh->is_leaf(node)) {
+          visit(lbvh->get_leaf(node));
+        } else {
+          stack[top++] = lbvh->get_right(node);
+          stack[top++] = lbvh->get_left(node);
+        }
+      }
+    } else {
+      // Every cell whose region meets the box, then all its triangles.
+      for (auto &cell : octotree->get_cells()) {
+        const Vector<PointTy> &lower = cell.get_lower();
+        const Vector<PointTy> &upper = cell.get_upper();
+        const Box<PointTy> &box = boxes[query];
+        if (lower.x > box.upper[0] || upper.x < box.lower[0] ||
+            lower.y > box.upper[1] || upper.y < box.lower[1] ||
+            lower.z > box.upper[2] || upper.z < box.lower[2])
+          continue;
+        for (const auto &trg : cell.get_trg_in_cell()) {
+          if (Box<PointTy>(trg, 8 * epsilon_).overlaps(box))
+            visit(0);
+        }
+      }
+    }
+  }
+
+  state.SetItemsProcessed(state.iterations());
+  state.counters["hits_per_query"] =
+      static_cast<double>(hits) / std::max<int64_t>(state.iterations(), 1);
+}
+
+const char *type_name(TYPE type) {
+  switch (type) {
+  case TYPE::POINT:
+    return "POINT";
+  case TYPE::LINE:
+    return "LINE";
+  case TYPE::TRIANGLE:
+    return "TRIANGLE";
+  default:
+    return "NONE";
+  }
+}
+
+void register_benchmarks() {
+  const TYPE types[] = {TYPE::TRIANGLE, TYPE::LINE, TYPE::POINT};
+  for (size_t i = 0; i < 3; ++i) {
+    for (size_t j = i; j < 3; ++j) {
+      std::string name = std::string("CheckIntersection/") +
+                         type_name(types[i]) + "_" + type_name(types[j]);
+      benchmark::RegisterBenchmark(name.c_str(),
+                                   BM_CheckIntersection<Kernel::INTERVALS>,
+                                   types[i], types[j]);
+    }
+  }
+
+  // The triangle-triangle kernels side by side on the same pairs.
+  benchmark::RegisterBenchmark("CheckIntersection/TRIANGLE_TRIANGLE/orient",
+                               BM_CheckIntersection<Kernel::ORIENTATION>,
+                               TYPE::TRIANGLE, TYPE::TRIANGLE);
+
+  benchmark::RegisterBenchmark("PlaneConstruction", BM_PlaneConstruction);
+  benchmark::RegisterBenchmark("IntersectLineWithLine",
+                               BM_IntersectLineWithLine);
+  benchmark::RegisterBenchmark("PointInTriangle", BM_PointInTriangle);
+
+  int64_t max_count = 10'000'000;
+  if (const char *env = std::getenv("TRIAG_BENCH_MAX_N"))
+    max_count = std::stoll(env);
+
+  for (Distribution distribution : all_distributions) {
+    std::string suffix = std::string("/") + distribution_name(distribution);
+
+    using Macro = void (*)(benchmark::State &, Distribution);
+    const std::pair<const char *, Macro> macros[] = {
+        {"Parse", BM_Parse},
+        {"DivideTree", BM_DivideTree},
+        {"FullRun", BM_FullRun<Engine::OCTOTREE, Kernel::INTERVALS>},
+        {"FullRunOrient", BM_FullRun<Engine::OCTOTREE, Kernel::ORIENTATION>},
+        {"FullRunLBVH", BM_FullRun<Engine::LBVH, Kernel::INTERVALS>},
+        {"FullRunBVTT", BM_FullRun<Engine::BVTT, Kernel::INTERVALS>},
+        {"FullRunLoose", BM_FullRun<Engine::LOOSE, Kernel::INTERVALS>},
+        {"FullRunKdTree", BM_FullRun<Engine::KDTREE, Kernel::INTERVALS>},
+        {"FullRunBVH8", BM_FullRun<Engine::BVH8, Kernel::INTERVALS>}};
+
+    for (auto [name, function] : macros) {
+      auto *bench = benchmark::RegisterBenchmark(
+          (std::string(name) + suffix).c_str(), function, distribution);
+      bench->Unit(benchmark::kMillisecond)->UseRealTime();
+      for (int64_t count = 1000; count <= max_count; count *= 10)
+        bench->Arg(count);
+    }
+
+    // Query throughput of the wide tree against the binary one and the
+    // flat list of octree cells.
+    const std::pair<const char *, Macro> queries[] = {
+        {"QueryBox/bvh8", BM_Query<QueryTree::BVH8, false>},
+        {"QueryBox/compact", BM_Query<QueryTree::COMPACT, false>},
+        {"QueryBox/lbvh", BM_Query<QueryTree::LBVH, false>},
+        {"QueryBox/octotree", BM_Query<QueryTree::OCTOTREE, false>},
+        {"QueryRay/bvh8", BM_Query<QueryTree::BVH8, true>},
+        {"QueryRay/lbvh", BM_Query<QueryTree::LBVH, true>}};
+
+    for (auto [name, function] : queries) {
+      auto *bench = benchmark::RegisterBenchmark(
+          (std::string(name) + suffix).c_str(), function, distribution);
+      bench->Unit(benchmark::kMicrosecond);
+      for (int64_t count = 1000; count <= std::min<int64_t>(max_count, 1'000'000);
+           count *= 10)
+        bench->Arg(count);
+    }
+  }
+}
+} // namespace
+
+int main(int argc, char **argv) {
+  perf::open();
+  register_benchmarks();
+  benchmark::Initialize(&argc, argv);
+  if (benchmark::ReportUnrecognizedArguments(argc, argv))
+    return 1;
+
+  benchmark::RunSpecifiedBenchmarks();
+  benchmark::Shutdown();
+  return 0;
+}
@@ -72,6 +72,54 @@ for test_file in "$test_dir"/test*.txt; do
         rm -f "$temp_result"
         exit 1
     fi
+
+    # Other id formats must describe the same set.
+    expected_count=$(wc -l < "$answer_file")
+    if [ "$("$triag_bin" --format=count < "$test_file")" != "$expected_count" ]; then
+        echo "$base_name --format=count failed"
+        rm -f "$temp_result"
+        exit 1
+    fi
+
+    "$triag_bin" --format=ranges --writer-thread < "$test_file" > "$temp_result"
+    if ! awk -F- '{ last = NF > 1 ? $2 : $1; for (i = $1; i <= last; i++) print i }' \
+            "$temp_result" | diff -q "$answer_file" - > /dev/null; then
+        echo "$base_name --format=ranges failed"
+        rm -f "$temp_result"
+        exit 1
+    fi
+
+    # The orientation kernel must find the same ids.
+    "$triag_bin" --kernel orient < "$test_file" > "$temp_result"
+    if ! diff -q "$answer_file" "$temp_result" > /dev/null; then
+        echo "$base_name --kernel orient failed"
+        rm -f "$temp_result"
+        exit 1
+    fi
+
+    # So must the other engines.
+    for engine in lbvh bvtt loose kdtree bvh8; do
+        "$triag_bin" --engine "$engine" < "$test_file" > "$temp_result"
+        if ! diff -q "$answer_file" "$temp_result" > /dev/null; then
+            echo "$base_name --engine $engine failed"
+            rm -f "$temp_result"
+            exit 1
+        fi
+    done
+
+    # Every pair must be printed once and the pairs must cover the same ids.
+    "$triag_bin" --pairs < "$test_file" > "$temp_result"
+    if [ -n "$(sort "$temp_result" | uniq -d)" ]; then
+        echo "$base_name --pairs failed: duplicate pairs"
+        rm -f "$temp_result"
+        exit 1
+    fi
+
+    if ! tr ' ' '\n' < "$temp_result" | sort -n -u | diff -q "$answer_file" - > /dev/null; then
+        echo "$base_name --pairs failed: ids differ from the answer"
+        rm -f "$temp_result"
+        exit 1
+    fi
 done
 
 rm -f "$temp_result"
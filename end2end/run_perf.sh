@@ -0,0 +1,194 @@
+#!/usr/bin/env bash
+
+# Performance regression gate. Runs triag several times on generated inputs,
+# takes the median wall time and the peak RSS of every case and compares them
+# with a baseline JSON. Fails if any case got slower (or bigger) than
+# threshold times the baseline. A missing baseline is an error; --update
+# saves the current results as the baseline instead of comparing. With
+# --build-type the run is skipped (exit code 77) if the baseline was taken
+# with another build type, whose times are not comparable.
+
+set -eo pipefail
+
+script_dir="$(cd "$(dirname "${BASH_SOURCE[0]}")" && pwd)"
+project_root="$(dirname "$script_dir")"
+
+current_time_us() {
+    echo $(($(date +%s%N) / 1000))
+}
+
+usage() {
+    echo "Usage: run_perf.sh [-b triag] [-g triag-gen] [-r runs] [-t threshold]"
+    echo "                   [-w work_dir] [--baseline file] [--update]"
+    echo "                   [--build-type type]"
+}
+
+triag_bin=""
+gen_bin=""
+runs=5
+threshold=1.5
+work_dir=""
+baseline=""
+build_type=""
+update=0
+
+# Cases as "distribution:count".
+cases=(
+    "uniform:50000"
+    "clusters:20000"
+    "coplanar:10000"
+    "degenerate:20000"
+    "long-lines:24000"
+)
+
+while [[ $# -gt 0 ]]; do
+    case "$1" in
+        -b)
+            triag_bin="$2"
+            shift 2
+            ;;
+        -g)
+            gen_bin="$2"
+            shift 2
+            ;;
+        -r)
+            runs="$2"
+            shift 2
+            ;;
+        -t)
+            threshold="$2"
+            shift 2
+            ;;
+        -w)
+            work_dir="$2"
+            shift 2
+            ;;
+        --baseline)
+            baseline="$2"
+            shift 2
+            ;;
+        --update)
+            update=1
+            shift
+            ;;
+        --build-type)
+            build_type="$2"
+            shift 2
+            ;;
+        *)
+            echo "Unknown option: $1"
+            usage
+            exit 1
+            ;;
+    esac
+done
+
+[ -z "$triag_bin" ] && triag_bin="${TRIAG_BIN:-$project_root/build/triag}"
+[ -z "$gen_bin" ] && gen_bin="$(dirname "$triag_bin")/triag-gen"
+[ -z "$work_dir" ] && work_dir="$(dirname "$triag_bin")/perf"
+[ -z "$baseline" ] && baseline="$project_root/perf/baseline.json"
+
+for bin in "$triag_bin" "$gen_bin"; do
+    if [ ! -f "$bin" ]; then
+        echo "ERROR: binary not found at: $bin"
+        usage
+        exit 1
+    fi
+done
+
+mkdir -p "$work_dir"
+stats_file="$work_dir/stats.json"
+
+# Value of "key" in the JSON object of case name in the baseline.
+baseline_value() {
+    grep "\"$1\"" "$baseline" | sed -E "s/.*\"$2\": ([0-9.]+).*/\1/"
+}
+
+if (( ! update )); then
+    if [ ! -f "$baseline" ]; then
+        echo "ERROR: no baseline at $baseline, create it with --update"
+        exit 1
+    fi
+
+    base_type=$(sed -nE 's/.*"build_type": "([^"]*)".*/\1/p' "$baseline")
+    if [ -n "$build_type" ] && [ "$build_type" != "$base_type" ]; then
+        echo "SKIPPED: the baseline is of a '$base_type' build, this one is '$build_type'"
+        exit 77
+    fi
+fi
+
+results=()
+failed=0
+
+for entry in "${cases[@]}"; do
+    distribution="${entry%%:*}"
+    count="${entry##*:}"
+    name="${distribution}_${count}"
+    input="$work_dir/$name.txt"
+
+    [ -f "$input" ] || "$gen_bin" -d "$distribution" -n "$count" -s 1 -o "$input"
+
+    timings=()
+    peak_rss=0
+    for ((i = 0; i < runs; ++i)); do
+        start_time=$(current_time_us)
+        "$triag_bin" --stats="$stats_file" < "$input" > /dev/null
+        timings+=($(( $(current_time_us) - start_time )))
+
+        rss=$(sed -nE 's/.*"peak_rss_kb": ([0-9]+).*/\1/p' "$stats_file")
+        (( rss > peak_rss )) && peak_rss=$rss
+    done
+
+    sorted=($(printf "%s\n" "${timings[@]}" | sort -n))
+    median_ms=$(awk "BEGIN { printf \"%.3f\", ${sorted[$((runs / 2))]} / 1000 }")
+    results+=("    \"$name\": {\"median_ms\": $median_ms, \"peak_rss_kb\": $peak_rss}")
+
+    if (( update )); then
+        echo "$name: median ${median_ms} ms, peak RSS ${peak_rss} KB"
+        continue
+    fi
+
+    base_ms=$(baseline_value "$name" median_ms)
+    base_rss=$(baseline_value "$name" peak_rss_kb)
+
+    if [ -z "$base_ms" ] || [ -z "$base_rss" ]; then
+        echo "$name: median ${median_ms} ms, peak RSS ${peak_rss} KB: NO BASELINE"
+        failed=1
+        continue
+    fi
+
+    verdict="ok"
+    if awk "BEGIN { exit !($median_ms > $base_ms * $threshold || $peak_rss > $base_rss * $threshold) }"; then
+        verdict="REGRESSION"
+        failed=1
+    fi
+
+    echo "$name: median ${median_ms} ms (baseline ${base_ms}), peak RSS ${peak_rss} KB (baseline ${base_rss}): $verdict"
+done
+
+rm -f "$stats_file"
+
+if (( update )); then
+    {
+        echo "{"
+        echo "  \"machine\": \"$(sed -nE 's/^model name[[:space:]]*: //p' /proc/cpuinfo | head -1), $(nproc) threads\","
+        echo "  \"build_type\": \"$build_type\","
+        echo "  \"runs\": $runs,"
+        echo "  \"tests\": {"
+        for ((i = 0; i < ${#results[@]}; ++i)); do
+            if (( i + 1 < ${#results[@]} )); then
+                echo "${results[$i]},"
+            else
+                echo "${results[$i]}"
+            fi
+        done
+        echo "  }"
+        echo "}"
+    } > "$baseline"
+    echo "Baseline written to $baseline"
+fi
+
+if (( failed )); then
+    echo "FAILED: slower or bigger than ${threshold}x the baseline, or not in it"
+    exit 1
+fi
@@ -0,0 +1,99 @@
+#pragma once
+
+#include "stats.hpp"
+#include <cstddef>
+#include <memory>
+#include <memory_resource>
+
+// Memory of the temporary structures of a run. Trees and per-worker scratch
+// take their memory from the resources below instead of the global heap,
+// which they ask only for large blocks, and give it all back in one shot
+// when they are destroyed. Both count the requests they serve and the blocks
+// they take from the heap into stats::arena.
+
+namespace triangle {
+
+// Passes requests to upstream and counts them into count. Unsynchronized,
+// as the resources it sits between.
+class CountingResource final : public std::pmr::memory_resource {
+  std::pmr::memory_resource *upstream;
+  stats::Allocations *count;
+
+  void *do_allocate(size_t bytes, size_t alignment) override {
+    ++count->count;
+    count->bytes += bytes;
+    return upstream->allocate(bytes, alignment);
+  }
+
+  void do_deallocate(void *pointer, size_t bytes, size_t alignment) override {
+    upstream->deallocate(pointer, bytes, alignment);
+  }
+
+  bool do_is_equal(const std::pmr::memory_resource &other) const noexcept
+      override {
+    return this == &other;
+  }
+
+public:
+  CountingResource(std::pmr::memory_resource *upstream,
+                   stats::Allocations *count)
+      : upstream(upstream), count(count) {}
+};
+
+// Scratch memory of one worker: a bump allocator over a block of
+// initial_size bytes. release() drops everything allocated since the last
+// call at once and starts over from the block, so work items of up to that
+// size never reach the heap. Not thread-safe.
+class Arena {
+  stats::Allocations served, heap;
+  CountingResource from_heap{std::pmr::new_delete_resource(), &heap};
+  std::unique_ptr<std::byte[]> initial;
+  std::pmr::monotonic_buffer_resource buffer;
+  CountingResource front{&buffer, &served};
+
+public:
+  static constexpr size_t default_size = size_t{64} << 10;
+
+  explicit Arena(size_t initial_size = default_size)
+      : initial(std::make_unique_for_overwrite<std::byte[]>(initial_size)),
+        buffer(initial.get(), initial_size, &from_heap) {
+    ++heap.count;
+    heap.bytes += initial_size;
+  }
+
+  Arena(const Arena &) = delete;
+  Arena &operator=(const Arena &) = delete;
+
+  ~Arena() {
+    buffer.release();
+    stats::add_arena(served, heap);
+  }
+
+  std::pmr::memory_resource *resource() { return &front; }
+
+  void release() { buffer.release(); }
+};
+
+// Memory of a tree whose nodes are freed and replaced while it is built, as
+// the octree replaces a cell by its children: pools of blocks by size, so
+// freed nodes are reused, returned to the heap with the tree. Not
+// thread-safe for allocation; concurrent reads of what it holds are fine.
+class TreeMemory {
+  stats::Allocations served, heap;
+  CountingResource from_heap{std::pmr::new_delete_resource(), &heap};
+  std::pmr::unsynchronized_pool_resource pool{&from_heap};
+  CountingResource front{&pool, &served};
+
+public:
+  TreeMemory() = default;
+  TreeMemory(const TreeMemory &) = delete;
+  TreeMemory &operator=(const TreeMemory &) = delete;
+
+  ~TreeMemory() {
+    pool.release();
+    stats::add_arena(served, heap);
+  }
+
+  std::pmr::memory_resource *resource() { return &front; }
+};
+} // namespace triangle
@@ -0,0 +1,36 @@
+#pragma once
+
+#include "triangles.hpp"
+#include <algorithm>
+
+namespace triangle {
+
+// Axis-aligned box of a triangle widened by margin on every side.
+template <typename PointTy = double> struct Box {
+  PointTy lower[3];
+  PointTy upper[3];
+
+  Box() = default;
+
+  Box(const Triangle<PointTy> &trg, PointTy margin)
+      : lower{trg.min_x() - margin, trg.min_y() - margin, trg.min_z() - margin},
+        upper{trg.max_x() + margin, trg.max_y() + margin,
+              trg.max_z() + margin} {}
+
+  // Smallest box containing both.
+  Box(const Box &one, const Box &two) {
+    for (int axis = 0; axis < 3; ++axis) {
+      lower[axis] = std::min(one.lower[axis], two.lower[axis]);
+      upper[axis] = std::max(one.upper[axis], two.upper[axis]);
+    }
+  }
+
+  bool overlaps(const Box &other) const {
+    for (int axis = 0; axis < 3; ++axis) {
+      if (lower[axis] > other.upper[axis] || upper[axis] < other.lower[axis])
+        return false;
+    }
+    return true;
+  }
+};
+} // namespace triangle
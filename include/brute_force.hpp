@@ -0,0 +1,103 @@
+#pragma once
+
+#include "parallel.hpp"
+#include "stats.hpp"
+#include "trace.hpp"
+#include "triangles.hpp"
+#include <cmath>
+#include <vector>
+
+namespace triangle {
+
+// Bounding boxes of all triangles as float arrays (structure of arrays), so
+// that the overlap test of one box against a block of boxes is a plain loop
+// of independent comparisons the compiler vectorizes. Boxes are rounded
+// outwards and widened by margin, so the filter never drops a pair that
+// check_intersection could accept within its epsilon.
+struct BoxArrays {
+  std::vector<float> min_x, min_y, min_z, max_x, max_y, max_z;
+
+  template <typename PointTy>
+  BoxArrays(const std::vector<Triangle<PointTy>> &input, double margin) {
+    size_t size = input.size();
+    for (auto *array : {&min_x, &min_y, &min_z, &max_x, &max_y, &max_z})
+      array->resize(size);
+
+    auto down = [&](double value) {
+      return std::nextafter(static_cast<float>(value - margin), -INFINITY);
+    };
+    auto up = [&](double value) {
+      return std::nextafter(static_cast<float>(value + margin), INFINITY);
+    };
+
+    for (size_t i = 0; i < size; ++i) {
+      min_x[i] = down(input[i].min_x());
+      min_y[i] = down(input[i].min_y());
+      min_z[i] = down(input[i].min_z());
+      max_x[i] = up(input[i].max_x());
+      max_y[i] = up(input[i].max_y());
+      max_z[i] = up(input[i].max_z());
+    }
+  }
+};
+
+// Reference O(N^2) search: every pair whose boxes overlap goes through
+// check_intersection. The triangle range is cut into blocks; a work item is
+// one block row, i.e. one block against itself and all later blocks, and rows
+// are shared among threads workers (early rows are longer, dynamic
+// scheduling evens that out). Each intersecting pair is reported once,
+// as on_pair(one, two, worker). K is the triangle-triangle kernel.
+template <Kernel K = Kernel::INTERVALS, typename PointTy = double,
+          typename PairFn>
+void brute_force_pairs(const std::vector<Triangle<PointTy>> &input,
+                       size_t threads, PairFn &&on_pair) {
+  constexpr size_t block = 256;
+
+  BoxArrays boxes(input, 16 * epsilon_);
+  size_t size = input.size();
+  size_t blocks = (size + block - 1) / block;
+
+  stats::Phase phase("narrow");
+  parallel_for(blocks, threads, [&](size_t row, size_t worker) {
+    trace::Span span("block_row", row);
+
+    size_t row_begin = row * block;
+    size_t row_end = std::min(size, row_begin + block);
+    unsigned char overlap[block];
+
+    // Column blocks stay in cache while every triangle of the row is tested
+    // against them.
+    for (size_t column = row; column < blocks; ++column) {
+      size_t column_end = std::min(size, (column + 1) * block);
+
+      for (size_t i = row_begin; i < row_end; ++i) {
+        size_t start = std::max(column * block, i + 1);
+        if (start >= column_end)
+          continue;
+
+        const float min_x = boxes.min_x[i], min_y = boxes.min_y[i],
+                    min_z = boxes.min_z[i], max_x = boxes.max_x[i],
+                    max_y = boxes.max_y[i], max_z = boxes.max_z[i];
+
+        // Branch-free filter, vectorized by the compiler.
+        for (size_t j = start; j < column_end; ++j) {
+          overlap[j - start] =
+              (boxes.min_x[j] <= max_x) & (boxes.max_x[j] >= min_x) &
+              (boxes.min_y[j] <= max_y) & (boxes.max_y[j] >= min_y) &
+              (boxes.min_z[j] <= max_z) & (boxes.max_z[j] >= min_z);
+        }
+
+        Triangle<PointTy> one = input[i];
+        for (size_t j = start; j < column_end; ++j) {
+          if (!overlap[j - start])
+            continue;
+
+          Triangle<PointTy> two = input[j];
+          if (check_intersection<K>(one, two))
+            on_pair(input[i], input[j], worker);
+        }
+      }
+    }
+  });
+}
+} // namespace triangle
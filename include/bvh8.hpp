@@ -0,0 +1,344 @@
+#pragma once
+
+#include "box.hpp"
+#include "lbvh.hpp"
+#include "parallel.hpp"
+#include "stats.hpp"
+#include "trace.hpp"
+#include "triangles.hpp"
+#include <bit>
+#include <cmath>
+#include <cstdint>
+#include <optional>
+#include <vector>
+
+#if defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__))
+#include <immintrin.h>
+#define TRIAG_BVH8_AVX2 1
+#endif
+
+namespace triangle {
+
+// Node of BVH8: the boxes of up to eight children as float arrays, one per
+// coordinate (structure of arrays), so that a query is tested against all
+// of them by one pass of 8-wide vector compares. Boxes are rounded outwards.
+// child[k] is a node, a leaf with leaf_flag, or empty, and last[k] is the
+// last leaf below it; children are in leaf order. 256 bytes, four cache
+// lines.
+struct alignas(64) BVH8Node {
+  static constexpr int width = 8;
+  static constexpr uint32_t leaf_flag = uint32_t{1} << 31;
+  static constexpr uint32_t empty = UINT32_MAX;
+
+  float lower[3][width];
+  float upper[3][width];
+  uint32_t child[width];
+  int32_t last[width];
+};
+
+// Query against the children of a node: the mask of the children to descend
+// into. One implementation per instruction set, chosen once at startup.
+struct BVH8BoxQuery {
+  float lower[3], upper[3];
+  int32_t after; // Only children with leaves after this one
+};
+
+struct BVH8RayQuery {
+  float origin[3], inverse[3]; // inverse: 1 / direction, finite
+  float from, to;              // Segment origin + t * direction, t in [from, to]
+};
+
+inline unsigned bvh8_box_mask_scalar(const BVH8Node &node,
+                                     const BVH8BoxQuery &query) {
+  unsigned mask = 0;
+  for (int k = 0; k < BVH8Node::width; ++k) {
+    bool hit = node.last[k] > query.after;
+    for (int axis = 0; axis < 3; ++axis)
+      hit &= (node.lower[axis][k] <= query.upper[axis]) &
+             (node.upper[axis][k] >= query.lower[axis]);
+    mask |= unsigned{hit} << k;
+  }
+  return mask;
+}
+
+inline unsigned bvh8_ray_mask_scalar(const BVH8Node &node,
+                                     const BVH8RayQuery &query) {
+  unsigned mask = 0;
+  for (int k = 0; k < BVH8Node::width; ++k) {
+    float near = query.from, far = query.to;
+    for (int axis = 0; axis < 3; ++axis) {
+      float one = (node.lower[axis][k] - query.origin[axis]) * query.inverse[axis];
+      float two = (node.upper[axis][k] - query.origin[axis]) * query.inverse[axis];
+      near = std::max(near, std::min(one, two));
+      far = std::min(far, std::max(one, two));
+    }
+    mask |= unsigned{near <= far} << k;
+  }
+  return mask;
+}
+
+#ifdef TRIAG_BVH8_AVX2
+__attribute__((target("avx2"))) inline unsigned
+bvh8_box_mask_avx2(const BVH8Node &node, const BVH8BoxQuery &query) {
+  __m256i last = _mm256_load_si256(reinterpret_cast<const __m256i *>(node.last));
+  __m256 hit = _mm256_castsi256_ps(
+      _mm256_cmpgt_epi32(last, _mm256_set1_epi32(query.after)));
+  for (int axis = 0; axis < 3; ++axis) {
+    __m256 lower = _mm256_load_ps(node.lower[axis]);
+    __m256 upper = _mm256_load_ps(node.upper[axis]);
+    hit = _mm256_and_ps(
+        hit, _mm256_cmp_ps(lower, _mm256_set1_ps(query.upper[axis]),
+                           _CMP_LE_OQ));
+    hit = _mm256_and_ps(
+        hit, _mm256_cmp_ps(upper, _mm256_set1_ps(query.lower[axis]),
+                           _CMP_GE_OQ));
+  }
+  return _mm256_movemask_ps(hit);
+}
+
+__attribute__((target("avx2"))) inline unsigned
+bvh8_ray_mask_avx2(const BVH8Node &node, const BVH8RayQuery &query) {
+  __m256 near = _mm256_set1_ps(query.from), far = _mm256_set1_ps(query.to);
+  for (int axis = 0; axis < 3; ++axis) {
+    __m256 origin = _mm256_set1_ps(query.origin[axis]);
+    __m256 inverse = _mm256_set1_ps(query.inverse[axis]);
+    __m256 one = _mm256_mul_ps(
+        _mm256_sub_ps(_mm256_load_ps(node.lower[axis]), origin), inverse);
+    __m256 two = _mm256_mul_ps(
+        _mm256_sub_ps(_mm256_load_ps(node.upper[axis]), origin), inverse);
+    near = _mm256_max_ps(near, _mm256_min_ps(one, two));
+    far = _mm256_min_ps(far, _mm256_max_ps(one, two));
+  }
+  return _mm256_movemask_ps(_mm256_cmp_ps(near, far, _CMP_LE_OQ));
+}
+#endif
+
+struct BVH8Masks {
+  unsigned (*box)(const BVH8Node &, const BVH8BoxQuery &);
+  unsigned (*ray)(const BVH8Node &, const BVH8RayQuery &);
+};
+
+// AVX2 where the CPU has it, the scalar loops otherwise.
+inline const BVH8Masks &bvh8_masks() {
+  static const BVH8Masks masks = [] {
+#ifdef TRIAG_BVH8_AVX2
+    if (__builtin_cpu_supports("avx2"))
+      return BVH8Masks{bvh8_box_mask_avx2, bvh8_ray_mask_avx2};
+#endif
+    return BVH8Masks{bvh8_box_mask_scalar, bvh8_ray_mask_scalar};
+  }();
+  return masks;
+}
+
+// 8-wide BVH, collapsed from a LinearBVH by LinearBVH::collapse(): a wide
+// node stands for the top three levels of a binary subtree, so a query
+// touches a third as many nodes, each tested at once. Leaves are single
+// triangles in Morton order, as in the LinearBVH.
+//
+// Besides the self-intersection search, the tree answers external queries
+// against the fixed set of triangles: boxes, rays and triangles.
+template <typename PointTy = double> class BVH8 {
+  std::vector<Triangle<PointTy>> leaves;
+  std::vector<Box<PointTy>> leaf_boxes;
+  std::vector<BVH8Node> nodes; // The root is 0
+
+  static float down(PointTy value) {
+    return std::nextafter(static_cast<float>(value), -INFINITY);
+  }
+
+  static float up(PointTy value) {
+    return std::nextafter(static_cast<float>(value), INFINITY);
+  }
+
+  // Collapses the subtree of binary under a new node; returns its index.
+  uint32_t collapse(const LinearBVH<PointTy> &bvh, uint32_t binary) {
+    uint32_t children[BVH8Node::width];
+    int count = bvh.collapse(binary, children, BVH8Node::width);
+
+    uint32_t index = nodes.size();
+    nodes.emplace_back();
+    for (int k = 0; k < BVH8Node::width; ++k) {
+      BVH8Node &node = nodes[index];
+      if (k >= count) {
+        for (int axis = 0; axis < 3; ++axis) {
+          node.lower[axis][k] = INFINITY;
+          node.upper[axis][k] = -INFINITY;
+        }
+        node.child[k] = BVH8Node::empty;
+        node.last[k] = -1;
+        continue;
+      }
+
+      const Box<PointTy> &box = bvh.get_box(children[k]);
+      for (int axis = 0; axis < 3; ++axis) {
+        node.lower[axis][k] = down(box.lower[axis]);
+        node.upper[axis][k] = up(box.upper[axis]);
+      }
+      node.last[k] = bvh.last_leaf(children[k]);
+
+      uint32_t child = bvh.is_leaf(children[k])
+                           ? bvh.get_leaf(children[k]) | BVH8Node::leaf_flag
+                           : collapse(bvh, children[k]);
+      nodes[index].child[k] = child;
+    }
+    return index;
+  }
+
+  // Depth-first walk over the children mask() selects; calls visit(leaf).
+  template <typename MaskFn, typename LeafFn>
+  void traverse(MaskFn &&mask, LeafFn &&visit) const {
+    if (nodes.empty())
+      return;
+
+    // Every level pushes at most seven more nodes than it pops, and the
+    // binary tree is at most 96 levels deep.
+    uint32_t stack[8 * 96];
+    size_t top = 0;
+    stack[top++] = 0;
+
+    while (top != 0) {
+      const BVH8Node &node = nodes[stack[--top]];
+      unsigned hits = mask(node);
+      // Pushed last to first, so that children are visited in leaf order.
+      while (hits != 0) {
+        int k = 31 - std::countl_zero(hits);
+        hits &= ~(1u << k);
+
+        uint32_t child = node.child[k];
+        if (child == BVH8Node::empty)
+          continue;
+        if (child & BVH8Node::leaf_flag)
+          visit(child & ~BVH8Node::leaf_flag);
+        else
+          stack[top++] = child;
+      }
+    }
+  }
+
+  BVH8BoxQuery box_query(const Box<PointTy> &box, int32_t after) const {
+    BVH8BoxQuery query;
+    for (int axis = 0; axis < 3; ++axis) {
+      query.lower[axis] = down(box.lower[axis]);
+      query.upper[axis] = up(box.upper[axis]);
+    }
+    query.after = after;
+    return query;
+  }
+
+public:
+  // Boxes are those of the LinearBVH: widened by 8 * epsilon_.
+  BVH8(const std::vector<Triangle<PointTy>> &input, size_t threads) {
+    LinearBVH<PointTy> bvh(input, threads);
+    if (bvh.size() == 0)
+      return;
+
+    nodes.reserve(bvh.size() / 4 + 1);
+    collapse(bvh, 0);
+
+    leaf_boxes.reserve(bvh.size());
+    for (uint32_t leaf = 0; leaf < bvh.size(); ++leaf)
+      leaf_boxes.push_back(bvh.get_leaf_box(leaf));
+    leaves = std::move(bvh.get_leaves());
+  }
+
+  size_t size() const { return leaves.size(); }
+
+  size_t node_count() const { return nodes.size(); }
+
+  std::vector<Triangle<PointTy>> &get_leaves() { return leaves; }
+
+  const Box<PointTy> &get_leaf_box(uint32_t leaf) const {
+    return leaf_boxes[leaf];
+  }
+
+  // Calls visit(leaf) for every leaf whose box overlaps box.
+  template <typename LeafFn>
+  void for_each_box_overlap(const Box<PointTy> &box, LeafFn &&visit) const {
+    BVH8BoxQuery query = box_query(box, -1);
+    auto mask = bvh8_masks().box;
+    traverse([&](const BVH8Node &node) { return mask(node, query); }, visit);
+  }
+
+  // Calls visit(other) for every leaf other > leaf whose box overlaps the
+  // one of leaf, as LinearBVH::for_each_overlap().
+  template <typename LeafFn>
+  void for_each_overlap(uint32_t leaf, LeafFn &&visit) const {
+    BVH8BoxQuery query = box_query(leaf_boxes[leaf], leaf);
+    auto mask = bvh8_masks().box;
+    traverse([&](const BVH8Node &node) { return mask(node, query); }, visit);
+  }
+
+  // Calls visit(leaf) for every leaf whose box the segment origin + t *
+  // direction, t in [from, to], crosses; the test against the triangle is
+  // left to visit.
+  template <typename LeafFn>
+  void for_each_ray_overlap(const Point<PointTy> &origin,
+                            const Vector<PointTy> &direction, PointTy from,
+                            PointTy to, LeafFn &&visit) const {
+    // A zero component gives a huge finite inverse instead of an infinity,
+    // whose product with a zero difference would be NaN.
+    auto inverse = [](PointTy value) {
+      constexpr float huge = 1e30f;
+      return value == 0 ? huge
+                        : std::clamp(static_cast<float>(1 / value), -huge, huge);
+    };
+
+    BVH8RayQuery query{{static_cast<float>(origin.x),
+                        static_cast<float>(origin.y),
+                        static_cast<float>(origin.z)},
+                       {inverse(direction.x), inverse(direction.y),
+                        inverse(direction.z)},
+                       static_cast<float>(from),
+                       static_cast<float>(to)};
+    auto mask = bvh8_masks().ray;
+    traverse([&](const BVH8Node &node) { return mask(node, query); }, visit);
+  }
+
+  // Calls visit(leaf) for every leaf that intersects trg, by the kernel K.
+  template <Kernel K = Kernel::INTERVALS, typename LeafFn>
+  void for_each_intersecting(Triangle<PointTy> &trg, LeafFn &&visit) {
+    for_each_box_overlap(Box<PointTy>(trg, 8 * epsilon_), [&](uint32_t leaf) {
+      if (check_intersection<K>(trg, leaves[leaf]))
+        visit(leaf);
+    });
+  }
+};
+
+// Builds a BVH8 over input and calls on_pair(one, two, worker) for every
+// intersecting pair, once, on threads workers, with one query per leaf as
+// lbvh_pairs(). Pairs within a coplanar group are skipped. K is the
+// triangle-triangle kernel.
+template <Kernel K = Kernel::INTERVALS, typename PointTy = double,
+          typename PairFn>
+void bvh8_pairs(const std::vector<Triangle<PointTy>> &input, size_t threads,
+                PairFn &&on_pair) {
+  constexpr size_t run = 64;
+
+  std::optional<BVH8<PointTy>> bvh;
+  {
+    stats::Phase phase("build");
+    bvh.emplace(input, threads);
+  }
+
+  std::vector<Triangle<PointTy>> &leaves = bvh->get_leaves();
+  size_t runs = (leaves.size() + run - 1) / run;
+
+  stats::Phase phase("narrow");
+  parallel_for(runs, threads, [&](size_t index, size_t worker) {
+    trace::Span span("leaves", index);
+
+    size_t end = std::min(leaves.size(), (index + 1) * run);
+    for (size_t leaf = index * run; leaf < end; ++leaf) {
+      Triangle<PointTy> &one = leaves[leaf];
+      bvh->for_each_overlap(leaf, [&](uint32_t other) {
+        Triangle<PointTy> &two = leaves[other];
+        if (same_plane_group(one, two))
+          return;
+
+        if (check_intersection<K>(one, two))
+          on_pair(one, two, worker);
+      });
+    }
+  });
+}
+} // namespace triangle
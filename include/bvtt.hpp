@@ -0,0 +1,121 @@
+#pragma once
+
+#include "lbvh.hpp"
+#include "parallel.hpp"
+#include "stats.hpp"
+#include "trace.hpp"
+#include "triangles.hpp"
+#include <algorithm>
+#include <deque>
+#include <optional>
+#include <utility>
+#include <vector>
+
+namespace triangle {
+
+// Self-collision of a LinearBVH by simultaneous descent of the bounding
+// volume test tree: a node against itself splits into its two children
+// against themselves and against each other, and a pair of different nodes
+// whose boxes overlap splits the one with more leaves. Pairs of disjoint
+// boxes are dropped with everything below them. Every triangle lives in one
+// leaf, so every overlapping pair of leaves is reached exactly once, and no
+// pair is tested twice.
+//
+// The top of the descent is expanded breadth-first into a few node pairs per
+// worker, which are then descended depth-first in parallel. Calls
+// visit(leaf1, leaf2, worker) with leaf1 < leaf2.
+template <typename PointTy = double, typename LeafPairFn>
+void for_each_overlapping_leaves(const LinearBVH<PointTy> &bvh,
+                                 size_t threads, LeafPairFn &&visit) {
+  using NodePair = std::pair<uint32_t, uint32_t>;
+
+  if (bvh.size() < 2)
+    return;
+
+  // One step of the descent from (one, two); returns false for a pair of
+  // leaves, which is to be visited instead.
+  auto split = [&](NodePair pair, auto &&push) {
+    auto [one, two] = pair;
+    if (one == two) {
+      if (bvh.is_leaf(one))
+        return true;
+      uint32_t left = bvh.get_left(one), right = bvh.get_right(one);
+      push(NodePair{left, right});
+      push(NodePair{left, left});
+      push(NodePair{right, right});
+      return true;
+    }
+
+    if (!bvh.get_box(one).overlaps(bvh.get_box(two)))
+      return true;
+
+    bool leaf_one = bvh.is_leaf(one), leaf_two = bvh.is_leaf(two);
+    if (leaf_one && leaf_two)
+      return false;
+
+    if (leaf_one || (!leaf_two && bvh.leaf_count(two) > bvh.leaf_count(one)))
+      std::swap(one, two);
+    push(NodePair{bvh.get_left(one), two});
+    push(NodePair{bvh.get_right(one), two});
+    return true;
+  };
+
+  auto visit_leaves = [&](NodePair pair, size_t worker) {
+    uint32_t one = bvh.get_leaf(pair.first), two = bvh.get_leaf(pair.second);
+    visit(std::min(one, two), std::max(one, two), worker);
+  };
+
+  size_t target = 64 * resolve_threads(threads);
+  std::deque<NodePair> queue{{0, 0}};
+  std::vector<NodePair> tasks;
+  while (!queue.empty() && queue.size() + tasks.size() < target) {
+    NodePair pair = queue.front();
+    queue.pop_front();
+    if (!split(pair, [&](NodePair child) { queue.push_back(child); }))
+      tasks.push_back(pair);
+  }
+  tasks.insert(tasks.end(), queue.begin(), queue.end());
+
+  std::vector<std::vector<NodePair>> stacks(resolve_threads(threads));
+  parallel_for(tasks.size(), threads, [&](size_t task, size_t worker) {
+    trace::Span span("node_pair", task);
+
+    std::vector<NodePair> &stack = stacks[worker];
+    stack.assign(1, tasks[task]);
+    while (!stack.empty()) {
+      NodePair pair = stack.back();
+      stack.pop_back();
+      if (!split(pair, [&](NodePair child) { stack.push_back(child); }))
+        visit_leaves(pair, worker);
+    }
+  });
+}
+
+// Builds a LinearBVH over input and calls on_pair(one, two, worker) for every
+// intersecting pair, once, found by for_each_overlapping_leaves(). Pairs
+// within a coplanar group are skipped. K is the triangle-triangle kernel.
+template <Kernel K = Kernel::INTERVALS, typename PointTy = double,
+          typename PairFn>
+void bvtt_pairs(const std::vector<Triangle<PointTy>> &input, size_t threads,
+                PairFn &&on_pair) {
+  std::optional<LinearBVH<PointTy>> bvh;
+  {
+    stats::Phase phase("build");
+    bvh.emplace(input, threads);
+  }
+
+  std::vector<Triangle<PointTy>> &leaves = bvh->get_leaves();
+
+  stats::Phase phase("narrow");
+  for_each_overlapping_leaves(
+      *bvh, threads, [&](uint32_t first, uint32_t second, size_t worker) {
+        Triangle<PointTy> &one = leaves[first];
+        Triangle<PointTy> &two = leaves[second];
+        if (same_plane_group(one, two))
+          return;
+
+        if (check_intersection<K>(one, two))
+          on_pair(one, two, worker);
+      });
+}
+} // namespace triangle
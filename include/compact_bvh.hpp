@@ -0,0 +1,316 @@
+#pragma once
+
+#include "box.hpp"
+#include "lbvh.hpp"
+#include "triangles.hpp"
+#include <algorithm>
+#include <bit>
+#include <cmath>
+#include <cstdint>
+#include <vector>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#define TRIAG_COMPACT_SSE2 1
+#endif
+
+namespace triangle {
+
+// Node of CompactBVH, one cache line: the boxes of up to four children,
+// quantized to 16 bits inside the box of the node itself, which the parent
+// holds and the traversal carries. Lower bounds count steps up from the
+// lower side of the node box, upper bounds steps down from its upper side,
+// so that both ends are exact and the quantized box always contains the
+// child. Child pointers are implicit: the children cover consecutive runs of
+// leaves, split at split[], and the internal ones are consecutive nodes
+// from children on.
+struct alignas(64) CompactNode {
+  static constexpr int width = 4;
+  static constexpr uint32_t steps = 65535;
+
+  uint16_t lower[3][width];
+  uint16_t upper[3][width];
+  uint32_t split[width - 1]; // First leaf of children 1, 2, 3
+  uint32_t children;         // First internal child
+};
+static_assert(sizeof(CompactNode) == 64);
+
+struct FloatBox {
+  float lower[3], upper[3];
+
+  bool overlaps(const FloatBox &other) const {
+    for (int axis = 0; axis < 3; ++axis) {
+      if (lower[axis] > other.upper[axis] || upper[axis] < other.lower[axis])
+        return false;
+    }
+    return true;
+  }
+};
+
+// 4-wide BVH in CompactNode form, collapsed from a LinearBVH by
+// LinearBVH::collapse(). A node takes a quarter of a BVH8Node and the
+// internal children of a node are stored together, so a query reads fewer
+// cache lines; the four boxes of a node are decoded and tested at once with
+// SSE2, and the node below on the stack is prefetched while the current one
+// is tested. Leaves are single triangles in Morton order. Only triag_bench
+// uses it, to compare node layouts: the decoding costs more than the smaller
+// nodes save, and on one core queries are slower than on the LinearBVH
+// itself, so it is not an engine.
+template <typename PointTy = double> class CompactBVH {
+  std::vector<Triangle<PointTy>> leaves;
+  std::vector<Box<PointTy>> leaf_boxes;
+  std::vector<CompactNode> nodes; // The root is 0
+  FloatBox root;
+
+  // A node to visit: its leaves and its box.
+  struct Entry {
+    uint32_t node, first, last;
+    FloatBox box;
+  };
+
+  static float down(PointTy value) {
+    return std::nextafter(static_cast<float>(value), -INFINITY);
+  }
+
+  static float up(PointTy value) {
+    return std::nextafter(static_cast<float>(value), INFINITY);
+  }
+
+  static FloatBox rounded(const Box<PointTy> &box) {
+    FloatBox result;
+    for (int axis = 0; axis < 3; ++axis) {
+      result.lower[axis] = down(box.lower[axis]);
+      result.upper[axis] = up(box.upper[axis]);
+    }
+    return result;
+  }
+
+  static float step(const FloatBox &box, int axis) {
+    return (box.upper[axis] - box.lower[axis]) * (1.0f / CompactNode::steps);
+  }
+
+  // Box of child k of node inside the node box, as the traversal sees it;
+  // size holds the steps of the node box.
+  static FloatBox decode(const CompactNode &node, int k, const FloatBox &box,
+                         const float size[3]) {
+    FloatBox child;
+    for (int axis = 0; axis < 3; ++axis) {
+      child.lower[axis] = box.lower[axis] + node.lower[axis][k] * size[axis];
+      child.upper[axis] = box.upper[axis] - node.upper[axis][k] * size[axis];
+    }
+    return child;
+  }
+
+  // The most steps that still keep the decoded box around child.
+  static void encode(CompactNode &node, int k, const FloatBox &box,
+                     const FloatBox &child) {
+    for (int axis = 0; axis < 3; ++axis) {
+      float size = step(box, axis);
+      uint32_t lower = 0, upper = 0;
+      if (size > 0) {
+        lower = std::clamp<float>(
+            std::floor((child.lower[axis] - box.lower[axis]) / size), 0,
+            CompactNode::steps);
+        upper = std::clamp<float>(
+            std::floor((box.upper[axis] - child.upper[axis]) / size), 0,
+            CompactNode::steps);
+        while (lower > 0 && box.lower[axis] + lower * size > child.lower[axis])
+          --lower;
+        while (upper > 0 && box.upper[axis] - upper * size < child.upper[axis])
+          --upper;
+      }
+      node.lower[axis][k] = lower;
+      node.upper[axis][k] = upper;
+    }
+  }
+
+  // Fills node index with the children of binary, whose box as decoded by
+  // the parent is box.
+  void collapse(const LinearBVH<PointTy> &bvh, uint32_t binary,
+                uint32_t index, const FloatBox &box) {
+    uint32_t children[CompactNode::width];
+    int count = bvh.collapse(binary, children, CompactNode::width);
+
+    int internal = 0;
+    for (int k = 0; k < count; ++k)
+      internal += !bvh.is_leaf(children[k]);
+    uint32_t first_child = nodes.size();
+    nodes.resize(nodes.size() + internal);
+
+    CompactNode &node = nodes[index];
+    node.children = first_child;
+    for (int k = 1; k < CompactNode::width; ++k) {
+      node.split[k - 1] = k < count ? bvh.first_leaf(children[k])
+                                    : bvh.last_leaf(binary) + 1;
+    }
+
+    float size[3] = {step(box, 0), step(box, 1), step(box, 2)};
+    FloatBox decoded[CompactNode::width];
+    for (int k = 0; k < CompactNode::width; ++k) {
+      if (k < count) {
+        encode(node, k, box, rounded(bvh.get_box(children[k])));
+        decoded[k] = decode(node, k, box, size);
+      } else {
+        for (int axis = 0; axis < 3; ++axis)
+          node.lower[axis][k] = node.upper[axis][k] = CompactNode::steps;
+      }
+    }
+
+    uint32_t child = first_child;
+    for (int k = 0; k < count; ++k) {
+      if (!bvh.is_leaf(children[k]))
+        collapse(bvh, children[k], child++, decoded[k]);
+    }
+  }
+
+  // Depth-first walk into the children whose decoded box overlaps query and
+  // that hold leaves after after; calls visit(leaf).
+  template <typename LeafFn>
+  void traverse(const FloatBox &query, int64_t after, LeafFn &&visit) const {
+    uint32_t size = leaves.size();
+    if (size == 0 || !root.overlaps(query))
+      return;
+    if (size == 1) {
+      if (after < 0)
+        visit(0);
+      return;
+    }
+
+    // Every level pushes at most three more nodes than it pops, and the
+    // binary tree is at most 96 levels deep.
+    Entry stack[4 * 96];
+    size_t top = 0;
+    stack[top++] = Entry{0, 0, size - 1, root};
+
+    while (top != 0) {
+      Entry entry = stack[--top];
+      const CompactNode &node = nodes[entry.node];
+      // The node under it is the next one unless this one has children to
+      // descend into: its load then overlaps the decoding of this node.
+      if (top != 0)
+        __builtin_prefetch(&nodes[stack[top - 1].node]);
+      float size[3] = {step(entry.box, 0), step(entry.box, 1),
+                       step(entry.box, 2)};
+
+      // Boxes of all children, decoded at once and widened by a step to make
+      // up for rounding, against the query.
+      alignas(16) float lower[3][CompactNode::width];
+      alignas(16) float upper[3][CompactNode::width];
+      unsigned hits = (1u << CompactNode::width) - 1;
+      for (int axis = 0; axis < 3; ++axis) {
+        float query_upper = query.upper[axis] + size[axis];
+        float query_lower = query.lower[axis] - size[axis];
+#ifdef TRIAG_COMPACT_SSE2
+        __m128i zero = _mm_setzero_si128();
+        __m128 scale = _mm_set1_ps(size[axis]);
+        __m128 lows = _mm_add_ps(
+            _mm_set1_ps(entry.box.lower[axis]),
+            _mm_mul_ps(_mm_cvtepi32_ps(_mm_unpacklo_epi16(
+                           _mm_loadl_epi64(reinterpret_cast<const __m128i *>(
+                               node.lower[axis])),
+                           zero)),
+                       scale));
+        __m128 highs = _mm_sub_ps(
+            _mm_set1_ps(entry.box.upper[axis]),
+            _mm_mul_ps(_mm_cvtepi32_ps(_mm_unpacklo_epi16(
+                           _mm_loadl_epi64(reinterpret_cast<const __m128i *>(
+                               node.upper[axis])),
+                           zero)),
+                       scale));
+        _mm_store_ps(lower[axis], lows);
+        _mm_store_ps(upper[axis], highs);
+        hits &= _mm_movemask_ps(
+            _mm_and_ps(_mm_cmple_ps(lows, _mm_set1_ps(query_upper)),
+                       _mm_cmpge_ps(highs, _mm_set1_ps(query_lower))));
+#else
+        unsigned axis_hits = 0;
+        for (int k = 0; k < CompactNode::width; ++k) {
+          lower[axis][k] =
+              entry.box.lower[axis] + node.lower[axis][k] * size[axis];
+          upper[axis][k] =
+              entry.box.upper[axis] - node.upper[axis][k] * size[axis];
+          axis_hits |= unsigned{(lower[axis][k] <= query_upper) &
+                                (upper[axis][k] >= query_lower)}
+                       << k;
+        }
+        hits &= axis_hits;
+#endif
+      }
+
+      // Children with leaves after after, and the internal ones among all
+      // children, whose nodes follow each other from node.children on.
+      uint32_t first[CompactNode::width + 1] = {
+          entry.first, node.split[0], node.split[1], node.split[2],
+          entry.last + 1};
+      unsigned later = 0, internal = 0;
+      for (int k = 0; k < CompactNode::width; ++k) {
+        later |= unsigned{first[k] != first[k + 1] &&
+                          static_cast<int64_t>(first[k + 1]) - 1 > after}
+                 << k;
+        internal |= unsigned{first[k + 1] - first[k] > 1} << k;
+      }
+
+      // Pushed last to first, so that children are visited in leaf order.
+      hits &= later;
+      while (hits != 0) {
+        int k = 31 - std::countl_zero(hits);
+        hits &= ~(1u << k);
+
+        if (!(internal >> k & 1)) {
+          visit(first[k]);
+          continue;
+        }
+        uint32_t index =
+            node.children + std::popcount(internal & ((1u << k) - 1));
+        stack[top++] = Entry{index, first[k], first[k + 1] - 1,
+                             FloatBox{{lower[0][k], lower[1][k], lower[2][k]},
+                                      {upper[0][k], upper[1][k], upper[2][k]}}};
+      }
+    }
+  }
+
+public:
+  // Boxes are those of the LinearBVH: widened by 8 * epsilon_.
+  CompactBVH(const std::vector<Triangle<PointTy>> &input, size_t threads) {
+    LinearBVH<PointTy> bvh(input, threads);
+    if (bvh.size() == 0)
+      return;
+
+    root = rounded(bvh.get_box(0));
+    if (bvh.size() > 1) {
+      nodes.reserve(bvh.size() / 2);
+      nodes.emplace_back();
+      collapse(bvh, 0, 0, root);
+    }
+
+    leaf_boxes.reserve(bvh.size());
+    for (uint32_t leaf = 0; leaf < bvh.size(); ++leaf)
+      leaf_boxes.push_back(bvh.get_leaf_box(leaf));
+    leaves = std::move(bvh.get_leaves());
+  }
+
+  size_t size() const { return leaves.size(); }
+
+  size_t node_count() const { return nodes.size(); }
+
+  std::vector<Triangle<PointTy>> &get_leaves() { return leaves; }
+
+  const Box<PointTy> &get_leaf_box(uint32_t leaf) const {
+    return leaf_boxes[leaf];
+  }
+
+  // Calls visit(leaf) for every leaf whose box overlaps box.
+  template <typename LeafFn>
+  void for_each_box_overlap(const Box<PointTy> &box, LeafFn &&visit) const {
+    traverse(rounded(box), -1, visit);
+  }
+
+  // Calls visit(other) for every leaf other > leaf whose box overlaps the
+  // one of leaf, as LinearBVH::for_each_overlap().
+  template <typename LeafFn>
+  void for_each_overlap(uint32_t leaf, LeafFn &&visit) const {
+    traverse(rounded(leaf_boxes[leaf]), leaf, visit);
+  }
+};
+
+} // namespace triangle
@@ -0,0 +1,199 @@
+#pragma once
+
+#include "parallel.hpp"
+#include "stats.hpp"
+#include "trace.hpp"
+#include "triangles.hpp"
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <tuple>
+#include <vector>
+
+namespace triangle {
+
+// Plane of a triangle as a sortable key: the normal with its dominant
+// component made positive and rounded to a multiple of epsilon_, and the
+// offset D with the matching sign. Sorted keys with one normal are grouped
+// while their offsets stay within epsilon_ of the first one (see
+// same_group()), so D may carry rounding noise, as it does on any plane that
+// is not axis-aligned. Any two keys of a group have normals and offsets
+// within epsilon_, which check_intersection() takes as coplanar, so grouping
+// never changes an answer. A normal within rounding noise of the middle
+// between two multiples splits its plane into two groups; the pairs across
+// them are left to the engine.
+struct PlaneKey {
+  int64_t a = 0, b = 0, c = 0;
+  double d = 0;
+  int axis = 0; // Dominant axis of the normal, dropped by the projection
+
+  template <typename PointTy> explicit PlaneKey(const Triangle<PointTy> &trg) {
+    Plane<PointTy> plane(trg.get_a(), trg.get_b(), trg.get_c());
+    PointTy normal[3] = {plane.get_A(), plane.get_B(), plane.get_C()};
+    PointTy offset = plane.get_D();
+
+    for (int i = 1; i < 3; ++i) {
+      if (std::abs(normal[i]) > std::abs(normal[axis]))
+        axis = i;
+    }
+
+    if (normal[axis] < 0) {
+      for (auto &component : normal)
+        component = -component;
+      offset = -offset;
+    }
+
+    // Rounded to the nearest cell: normals made of short decimals, such as
+    // (0.6, 0.8, 0), are cell centres rather than boundaries.
+    a = std::llround(normal[0] / epsilon_);
+    b = std::llround(normal[1] / epsilon_);
+    c = std::llround(normal[2] / epsilon_);
+    d = static_cast<double>(offset);
+  }
+
+  bool operator<(const PlaneKey &other) const {
+    return std::tie(a, b, c, d) < std::tie(other.a, other.b, other.c, other.d);
+  }
+
+  // This key, sorted after first, belongs to the group that first begins.
+  bool same_group(const PlaneKey &first) const {
+    return a == first.a && b == first.b && c == first.c &&
+           d - first.d <= epsilon_;
+  }
+};
+
+// A triangle of a coplanar group projected onto its plane.
+struct FlatTriangle {
+  double u[3], v[3];
+  double min_u, max_u, min_v, max_v;
+  uint32_t id;
+
+  template <typename PointTy>
+  FlatTriangle(const Triangle<PointTy> &trg, int dropped_axis, uint32_t id)
+      : id(id) {
+    Point<PointTy> vertices[3] = {trg.get_a(), trg.get_b(), trg.get_c()};
+    for (int i = 0; i < 3; ++i) {
+      PointTy coordinates[3] = {vertices[i].x, vertices[i].y, vertices[i].z};
+      u[i] = coordinates[(dropped_axis + 1) % 3];
+      v[i] = coordinates[(dropped_axis + 2) % 3];
+    }
+
+    min_u = std::min({u[0], u[1], u[2]});
+    max_u = std::max({u[0], u[1], u[2]});
+    min_v = std::min({v[0], v[1], v[2]});
+    max_v = std::max({v[0], v[1], v[2]});
+  }
+};
+
+// True if no edge normal of one separates it from two (touching counts as
+// overlapping, within epsilon_).
+inline bool separated_by_edges(const FlatTriangle &one,
+                               const FlatTriangle &two) {
+  for (int i = 0; i < 3; ++i) {
+    int j = (i + 1) % 3;
+    double normal_u = one.v[j] - one.v[i];
+    double normal_v = one.u[i] - one.u[j];
+    double tolerance =
+        epsilon_ * std::sqrt(normal_u * normal_u + normal_v * normal_v);
+
+    auto project = [&](const FlatTriangle &trg, int k) {
+      return normal_u * trg.u[k] + normal_v * trg.v[k];
+    };
+
+    double one_min = std::min({project(one, 0), project(one, 1),
+                               project(one, 2)});
+    double one_max = std::max({project(one, 0), project(one, 1),
+                               project(one, 2)});
+    double two_min = std::min({project(two, 0), project(two, 1),
+                               project(two, 2)});
+    double two_max = std::max({project(two, 0), project(two, 1),
+                               project(two, 2)});
+
+    if (two_min > one_max + tolerance || two_max < one_min - tolerance)
+      return true;
+  }
+  return false;
+}
+
+// Separating axis test of two triangles in one plane.
+inline bool intersect_flat_triangles(const FlatTriangle &one,
+                                     const FlatTriangle &two) {
+  return !separated_by_edges(one, two) && !separated_by_edges(two, one);
+}
+
+// Finds groups of coplanar TRIANGLE-type triangles and reports their
+// intersecting pairs as on_pair(one, two, worker): each group is projected
+// onto its plane and swept along u, and candidates with overlapping 2D
+// boxes get a 2D separating axis test. Members of groups of two or more get
+// a nonzero plane_group, so that the engine can skip pairs within a group.
+template <typename PointTy = double, typename PairFn>
+void coplanar_pairs(std::vector<Triangle<PointTy>> &triangles, size_t threads,
+                    PairFn &&on_pair) {
+  using TYPE = typename Triangle<PointTy>::TriangleType;
+  const double margin = epsilon_;
+
+  std::vector<std::pair<PlaneKey, uint32_t>> keys;
+  // Ranges of keys of the groups with at least two triangles.
+  std::vector<std::pair<size_t, size_t>> groups;
+  {
+    stats::Phase phase("classify");
+    keys.reserve(triangles.size());
+    for (size_t i = 0; i < triangles.size(); ++i) {
+      if (triangles[i].get_type() == TYPE::TRIANGLE)
+        keys.emplace_back(PlaneKey(triangles[i]), i);
+    }
+
+    std::sort(keys.begin(), keys.end(), [](const auto &one, const auto &two) {
+      return one.first < two.first ||
+             (!(two.first < one.first) && one.second < two.second);
+    });
+
+    for (size_t begin = 0, end; begin < keys.size(); begin = end) {
+      end = begin + 1;
+      while (end < keys.size() && keys[end].first.same_group(keys[begin].first))
+        ++end;
+
+      if (end - begin < 2)
+        continue;
+
+      groups.emplace_back(begin, end);
+      for (size_t k = begin; k < end; ++k)
+        triangles[keys[k].second].plane_group = groups.size();
+    }
+  }
+
+  if (groups.empty())
+    return;
+
+  stats::Phase phase("narrow");
+  parallel_for(groups.size(), threads, [&](size_t group, size_t worker) {
+    auto [begin, end] = groups[group];
+    trace::Span span("plane", end - begin);
+
+    int axis = keys[begin].first.axis;
+    std::vector<FlatTriangle> flat;
+    flat.reserve(end - begin);
+    for (size_t k = begin; k < end; ++k)
+      flat.emplace_back(triangles[keys[k].second], axis, keys[k].second);
+
+    std::sort(flat.begin(), flat.end(),
+              [](const FlatTriangle &one, const FlatTriangle &two) {
+                return one.min_u < two.min_u;
+              });
+
+    for (size_t i = 0; i < flat.size(); ++i) {
+      for (size_t j = i + 1;
+           j < flat.size() && flat[j].min_u <= flat[i].max_u + margin; ++j) {
+        if (flat[j].min_v > flat[i].max_v + margin ||
+            flat[j].max_v < flat[i].min_v - margin)
+          continue;
+
+        TRIAG_STAT_PAIR_TYPE(TYPE::TRIANGLE, TYPE::TRIANGLE);
+        TRIAG_STAT_TT_EXIT(TT_COPLANAR);
+        if (intersect_flat_triangles(flat[i], flat[j]))
+          on_pair(triangles[flat[i].id], triangles[flat[j].id], worker);
+      }
+    }
+  });
+}
+} // namespace triangle
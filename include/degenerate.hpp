@@ -0,0 +1,280 @@
+#pragma once
+
+#include "box.hpp"
+#include "parallel.hpp"
+#include "stats.hpp"
+#include "trace.hpp"
+#include "triangles.hpp"
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <limits>
+#include <utility>
+#include <vector>
+
+namespace triangle {
+
+// Uniform grid with hashed cells over boxes and segments, for box and
+// segment queries. A box is listed in every cell it touches; boxes touching
+// more than max_box_cells cells go to a list every query visits instead, so
+// a few scene-sized triangles do not fill the whole grid. A segment is
+// listed only in the cells along it, however long it is. Entries are kept as
+// one array of (cell key, id) sorted by key after all inserts: building it
+// is a single sort instead of a hash map of small vectors.
+template <typename PointTy = double> class HashedGrid {
+  static constexpr int64_t max_box_cells = 64;
+
+  PointTy cell_size;
+  std::vector<std::pair<uint64_t, uint32_t>> entries;
+  std::vector<uint32_t> large;
+
+  int64_t cell_of(PointTy value) const {
+    return static_cast<int64_t>(std::floor(value / cell_size));
+  }
+
+  // Different cells may share a key; that only adds candidates.
+  static uint64_t key(int64_t x, int64_t y, int64_t z) {
+    return static_cast<uint64_t>(x) * 73856093u ^
+           static_cast<uint64_t>(y) * 19349663u ^
+           static_cast<uint64_t>(z) * 83492791u;
+  }
+
+  // Calls visit(key) for the cells touched by box, or returns false without
+  // calling it if there are more than limit of them.
+  template <typename KeyFn>
+  bool for_each_cell(const Box<PointTy> &box, int64_t limit,
+                     KeyFn &&visit) const {
+    int64_t from[3], to[3];
+    int64_t count = 1;
+    for (int axis = 0; axis < 3; ++axis) {
+      from[axis] = cell_of(box.lower[axis]);
+      to[axis] = cell_of(box.upper[axis]);
+      count *= to[axis] - from[axis] + 1;
+      if (count > limit)
+        return false;
+    }
+
+    for (int64_t x = from[0]; x <= to[0]; ++x)
+      for (int64_t y = from[1]; y <= to[1]; ++y)
+        for (int64_t z = from[2]; z <= to[2]; ++z)
+          visit(key(x, y, z));
+    return true;
+  }
+
+  // Calls visit(key) once for every cell within margin of the segment from
+  // a to b. The segment is walked in pieces no longer than a cell along any
+  // axis, each covering at most a few cells; the cells of a piece only move
+  // forward along every axis, so those already covered by the previous
+  // piece are the ones visited before.
+  template <typename KeyFn>
+  void for_each_segment_cell(const Point<PointTy> &a, const Point<PointTy> &b,
+                             PointTy margin, KeyFn &&visit) const {
+    const PointTy start[3] = {a.x, a.y, a.z};
+    const PointTy delta[3] = {b.x - a.x, b.y - a.y, b.z - a.z};
+    PointTy longest = std::max(
+        {std::abs(delta[0]), std::abs(delta[1]), std::abs(delta[2])});
+    int64_t pieces = std::max<int64_t>(
+        1, static_cast<int64_t>(std::ceil(longest / cell_size)));
+
+    int64_t last_from[3] = {0, 0, 0}, last_to[3] = {-1, -1, -1};
+    for (int64_t piece = 0; piece < pieces; ++piece) {
+      PointTy begin = static_cast<PointTy>(piece) / pieces;
+      PointTy end = static_cast<PointTy>(piece + 1) / pieces;
+
+      int64_t from[3], to[3];
+      for (int axis = 0; axis < 3; ++axis) {
+        PointTy one = start[axis] + delta[axis] * begin;
+        PointTy two = start[axis] + delta[axis] * end;
+        from[axis] = cell_of(std::min(one, two) - margin);
+        to[axis] = cell_of(std::max(one, two) + margin);
+      }
+
+      auto covered = [&](int axis, int64_t cell) {
+        return cell >= last_from[axis] && cell <= last_to[axis];
+      };
+      for (int64_t x = from[0]; x <= to[0]; ++x)
+        for (int64_t y = from[1]; y <= to[1]; ++y)
+          for (int64_t z = from[2]; z <= to[2]; ++z)
+            if (!(covered(0, x) && covered(1, y) && covered(2, z)))
+              visit(key(x, y, z));
+
+      std::copy(from, from + 3, last_from);
+      std::copy(to, to + 3, last_to);
+    }
+  }
+
+  void append(uint64_t key, std::vector<uint32_t> &result) const {
+    auto entry = std::lower_bound(entries.begin(), entries.end(),
+                                  std::make_pair(key, uint32_t{0}));
+    for (; entry != entries.end() && entry->first == key; ++entry)
+      result.push_back(entry->second);
+  }
+
+  void finish_query(std::vector<uint32_t> &result) const {
+    result.insert(result.end(), large.begin(), large.end());
+    std::sort(result.begin(), result.end());
+    result.erase(std::unique(result.begin(), result.end()), result.end());
+  }
+
+public:
+  explicit HashedGrid(PointTy cell_size) : cell_size(cell_size) {}
+
+  void insert(uint32_t id, const Box<PointTy> &box) {
+    bool listed = for_each_cell(
+        box, max_box_cells, [&](uint64_t key) { entries.emplace_back(key, id); });
+    if (!listed)
+      large.push_back(id);
+  }
+
+  // Lists id in the cells within margin of the segment from a to b.
+  void insert_segment(uint32_t id, const Point<PointTy> &a,
+                      const Point<PointTy> &b, PointTy margin) {
+    for_each_segment_cell(a, b, margin,
+                          [&](uint64_t key) { entries.emplace_back(key, id); });
+  }
+
+  // Must be called after the last insert() and before query().
+  void finish() { std::sort(entries.begin(), entries.end()); }
+
+  // Appends to result the ids whose cells box touches, sorted and unique.
+  // Visits every cell of box, so it is meant for boxes of a few cells.
+  void query(const Box<PointTy> &box, std::vector<uint32_t> &result) const {
+    result.clear();
+    for_each_cell(box, std::numeric_limits<int64_t>::max(),
+                  [&](uint64_t key) { append(key, result); });
+    finish_query(result);
+  }
+
+  // Appends to result the ids listed in the cells within margin of the
+  // segment from a to b, sorted and unique. Takes time in proportion to the
+  // cells along the segment, not to the cells of its box.
+  void query_segment(const Point<PointTy> &a, const Point<PointTy> &b,
+                     PointTy margin, std::vector<uint32_t> &result) const {
+    result.clear();
+    for_each_segment_cell(a, b, margin,
+                          [&](uint64_t key) { append(key, result); });
+    finish_query(result);
+  }
+};
+
+// Ends of the segment a LINE triangle stands for: the two of its vertices
+// farthest apart.
+template <typename PointTy = double>
+std::pair<Point<PointTy>, Point<PointTy>>
+segment_ends(const Triangle<PointTy> &line) {
+  Point<PointTy> a = line.get_a(), b = line.get_b(), c = line.get_c();
+  auto length = [](const Point<PointTy> &one, const Point<PointTy> &two) {
+    Vector<PointTy> gap = one - two;
+    return dot(gap, gap);
+  };
+
+  PointTy ab = length(a, b), ac = length(a, c), bc = length(b, c);
+  if (ab >= ac && ab >= bc)
+    return {a, b};
+  return ac >= bc ? std::make_pair(a, c) : std::make_pair(b, c);
+}
+
+// Pairs with at least one POINT or LINE operand, found without the broad
+// phase engine:
+//  - points against points through a hashed grid of epsilon-sized cells,
+//    so coincident points are found in near-linear time;
+//  - points and lines against lines and triangles through a hashed grid
+//    over the lines and triangles, with cells about the size of a typical
+//    triangle. Lines are listed and looked up only in the cells along them,
+//    so a long line costs in proportion to its length in cells.
+// Each pair is reported once, as on_pair(one, two, worker), on threads
+// workers. Degenerate triangles are usually few and small, so this is much
+// cheaper than putting them into the engine with the real ones.
+template <typename PointTy = double, typename PairFn>
+void degenerate_pairs(const std::vector<Triangle<PointTy>> &input,
+                      const std::vector<uint32_t> &points,
+                      const std::vector<uint32_t> &lines,
+                      const std::vector<uint32_t> &solids, size_t threads,
+                      PairFn &&on_pair) {
+  using TYPE = typename Triangle<PointTy>::TriangleType;
+  const PointTy margin = 16 * epsilon_;
+
+  // Median extent of the indexed boxes: robust to a few huge triangles.
+  std::vector<PointTy> extents;
+  for (const auto *group : {&lines, &solids}) {
+    for (uint32_t id : *group) {
+      const Triangle<PointTy> &trg = input[id];
+      extents.push_back(std::max({trg.max_x() - trg.min_x(),
+                                  trg.max_y() - trg.min_y(),
+                                  trg.max_z() - trg.min_z()}));
+    }
+  }
+
+  PointTy cell_size = 1;
+  if (!extents.empty()) {
+    auto middle = extents.begin() + extents.size() / 2;
+    std::nth_element(extents.begin(), middle, extents.end());
+    cell_size = std::max<PointTy>(*middle, 1024 * margin);
+  }
+
+  HashedGrid<PointTy> point_grid(4 * margin);
+  HashedGrid<PointTy> index(cell_size);
+  {
+    stats::Phase phase("classify");
+    for (uint32_t id : points)
+      point_grid.insert(id, Box<PointTy>(input[id], 0));
+    for (uint32_t id : lines) {
+      auto [a, b] = segment_ends(input[id]);
+      index.insert_segment(id, a, b, margin);
+    }
+    for (uint32_t id : solids)
+      index.insert(id, Box<PointTy>(input[id], 0));
+    point_grid.finish();
+    index.finish();
+  }
+
+  stats::Phase phase("narrow");
+
+  // Queries of points first, then of lines: one work item per query.
+  size_t queries = points.size() + lines.size();
+  std::vector<std::vector<uint32_t>> candidates(threads);
+
+  parallel_for(queries, threads, [&](size_t query, size_t worker) {
+    bool is_point = query < points.size();
+    uint32_t id = is_point ? points[query] : lines[query - points.size()];
+    Triangle<PointTy> one = input[id];
+    Box<PointTy> box(one, margin);
+    std::vector<uint32_t> &found = candidates[worker];
+
+    auto test = [&](uint32_t other_id, auto &&kernel) {
+      Triangle<PointTy> two = input[other_id];
+      if (box.overlaps(Box<PointTy>(two, 0)) && kernel(one, two))
+        on_pair(input[id], input[other_id], worker);
+    };
+
+    if (is_point) {
+      point_grid.query(box, found);
+      for (uint32_t other : found) {
+        if (other > id)
+          test(other, check_intersection_of<TYPE::POINT, TYPE::POINT, PointTy>);
+      }
+    }
+
+    if (is_point) {
+      index.query(box, found);
+    } else {
+      auto [a, b] = segment_ends(one);
+      index.query_segment(a, b, margin, found);
+    }
+    for (uint32_t other : found) {
+      if (input[other].get_type() == TYPE::TRIANGLE) {
+        if (is_point)
+          test(other,
+               check_intersection_of<TYPE::POINT, TYPE::TRIANGLE, PointTy>);
+        else
+          test(other,
+               check_intersection_of<TYPE::LINE, TYPE::TRIANGLE, PointTy>);
+      } else if (is_point) {
+        test(other, check_intersection_of<TYPE::POINT, TYPE::LINE, PointTy>);
+      } else if (other > id) {
+        test(other, check_intersection_of<TYPE::LINE, TYPE::LINE, PointTy>);
+      }
+    }
+  });
+}
+} // namespace triangle
@@ -0,0 +1,298 @@
+#pragma once
+
+#include "triangles.hpp"
+#include <array>
+#include <cmath>
+#include <optional>
+#include <random>
+#include <string_view>
+#include <vector>
+
+namespace triangle {
+
+// Synthetic triangle distributions for benchmarks and stress tests.
+enum class Distribution {
+  UNIFORM,      // Small triangles scattered uniformly in a cube
+  CLUSTERS,     // Small triangles around Gaussian cluster centres
+  COPLANAR,     // Dense sheets of triangles in a few axis-aligned planes
+  SLIVERS,      // Long, very thin triangles in random directions
+  GRID,         // Regular triangulated grids sharing edges and vertices
+  DEGENERATE,   // Mix of POINT, LINE and small TRIANGLE triangles
+  OCTREE_WORST, // Scene-spanning triangles plus triangles on split planes
+  LONG_LINES,   // Small triangles plus scene-length LINE segments
+};
+
+inline constexpr Distribution all_distributions[] = {
+    Distribution::UNIFORM,    Distribution::CLUSTERS,
+    Distribution::COPLANAR,   Distribution::SLIVERS,
+    Distribution::GRID,       Distribution::DEGENERATE,
+    Distribution::OCTREE_WORST, Distribution::LONG_LINES};
+
+inline const char *distribution_name(Distribution distribution) {
+  switch (distribution) {
+  case Distribution::UNIFORM:
+    return "uniform";
+  case Distribution::CLUSTERS:
+    return "clusters";
+  case Distribution::COPLANAR:
+    return "coplanar";
+  case Distribution::SLIVERS:
+    return "slivers";
+  case Distribution::GRID:
+    return "grid";
+  case Distribution::DEGENERATE:
+    return "degenerate";
+  case Distribution::OCTREE_WORST:
+    return "octree-worst";
+  case Distribution::LONG_LINES:
+    return "long-lines";
+  }
+  return "unknown";
+}
+
+inline std::optional<Distribution> parse_distribution(std::string_view name) {
+  for (Distribution distribution : all_distributions) {
+    if (name == distribution_name(distribution))
+      return distribution;
+  }
+  return std::nullopt;
+}
+
+// Produces triangles of a distribution one at a time, so datasets of any size
+// can be streamed: only O(clusters + sheets) state is kept. The scene grows
+// with count to keep the density (and hence the number of intersections per
+// triangle) roughly constant. The same seed always gives the same sequence.
+class TriangleGenerator {
+  Distribution distribution;
+  std::mt19937_64 random;
+  size_t count;
+  size_t index = 0;
+  double scene_size;
+
+  std::vector<std::array<double, 3>> centres;
+  double spread = 1.0;
+  size_t grid_side = 1;
+
+  double uniform(double min, double max) {
+    return std::uniform_real_distribution<double>(min, max)(random);
+  }
+
+  double normal(double mean, double deviation) {
+    return std::normal_distribution<double>(mean, deviation)(random);
+  }
+
+  size_t pick(size_t size) {
+    return std::uniform_int_distribution<size_t>(0, size - 1)(random);
+  }
+
+  // Triangle with vertices scattered around (x, y, z) within radius.
+  std::array<double, 9> around(double x, double y, double z, double radius) {
+    std::array<double, 9> coordinates;
+    for (size_t vertex = 0; vertex < 3; ++vertex) {
+      coordinates[vertex * 3 + 0] = x + uniform(-radius, radius);
+      coordinates[vertex * 3 + 1] = y + uniform(-radius, radius);
+      coordinates[vertex * 3 + 2] = z + uniform(-radius, radius);
+    }
+    return coordinates;
+  }
+
+  std::array<double, 9> coplanar() {
+    // Even sheets are floors (z = const), odd ones are facades (x = const).
+    size_t sheet = pick(centres.size());
+    double level = centres[sheet][0];
+    double u = uniform(0, scene_size), v = uniform(0, scene_size);
+    size_t normal_axis = sheet % 2 == 0 ? 2 : 0;
+    size_t u_axis = sheet % 2 == 0 ? 0 : 1;
+    size_t v_axis = sheet % 2 == 0 ? 1 : 2;
+
+    std::array<double, 9> coordinates;
+    for (size_t vertex = 0; vertex < 3; ++vertex) {
+      coordinates[vertex * 3 + normal_axis] = level;
+      coordinates[vertex * 3 + u_axis] = u + uniform(-2.0, 2.0);
+      coordinates[vertex * 3 + v_axis] = v + uniform(-2.0, 2.0);
+    }
+    return coordinates;
+  }
+
+  std::array<double, 9> sliver() {
+    std::array<double, 3> origin = {uniform(0, scene_size),
+                                    uniform(0, scene_size),
+                                    uniform(0, scene_size)};
+    std::array<double, 3> direction = {normal(0, 1), normal(0, 1),
+                                       normal(0, 1)};
+    double norm = std::sqrt(direction[0] * direction[0] +
+                            direction[1] * direction[1] +
+                            direction[2] * direction[2]);
+    if (norm == 0.0) {
+      direction = {1.0, 0.0, 0.0};
+      norm = 1.0;
+    }
+
+    double length = scene_size / 10.0;
+    std::array<double, 9> coordinates;
+    for (size_t axis = 0; axis < 3; ++axis) {
+      double end = origin[axis] + direction[axis] / norm * length;
+      coordinates[0 + axis] = origin[axis];
+      coordinates[3 + axis] = end;
+      coordinates[6 + axis] = end + uniform(-1e-3, 1e-3);
+    }
+    return coordinates;
+  }
+
+  std::array<double, 9> grid() {
+    // Cell (i, j) of layer k is split into two triangles along its diagonal.
+    size_t cell = index / 2;
+    size_t layer_cells = grid_side * grid_side;
+    double k = static_cast<double>(cell / layer_cells);
+    double i = static_cast<double>(cell % layer_cells / grid_side);
+    double j = static_cast<double>(cell % grid_side);
+
+    if (index % 2 == 0)
+      return {i, j, k, i + 1, j, k, i + 1, j + 1, k};
+    return {i, j, k, i + 1, j + 1, k, i, j + 1, k};
+  }
+
+  std::array<double, 9> degenerate() {
+    // Points and segment ends are snapped to a lattice, so coincident points
+    // and touching segments really occur.
+    auto snap = [](double value) { return std::round(value * 2.0) / 2.0; };
+    double x = snap(uniform(0, scene_size)), y = snap(uniform(0, scene_size)),
+           z = snap(uniform(0, scene_size));
+
+    switch (pick(3)) {
+    case 0:
+      return {x, y, z, x, y, z, x, y, z};
+    case 1: {
+      double x2 = snap(x + uniform(-2, 2)), y2 = snap(y + uniform(-2, 2)),
+             z2 = snap(z + uniform(-2, 2));
+      return {x, y, z, x2, y2, z2, (x + x2) / 2, (y + y2) / 2, (z + z2) / 2};
+    }
+    default:
+      return around(x, y, z, 1.0);
+    }
+  }
+
+  std::array<double, 9> octree_worst() {
+    // One in ten triangles spans the whole scene and straddles every split;
+    // the rest are centred on dyadic points, i.e. on the midpoint planes
+    // the octree will choose.
+    if (pick(10) == 0) {
+      return {0.0,        uniform(0, scene_size), uniform(0, scene_size),
+              scene_size, uniform(0, scene_size), uniform(0, scene_size),
+              uniform(0, scene_size), uniform(0, scene_size), scene_size};
+    }
+
+    double cells = static_cast<double>(size_t{1} << (1 + pick(6)));
+    auto dyadic = [&]() {
+      return std::floor(uniform(1, cells)) * scene_size / cells;
+    };
+    return around(dyadic(), dyadic(), dyadic(), 0.5);
+  }
+
+  std::array<double, 9> long_line() {
+    // One in six is an exact LINE (a a b) from one side of the scene to the
+    // other, as the slivers CAD exports collapse to; the rest are small
+    // triangles.
+    if (pick(6) != 0) {
+      return around(uniform(0, scene_size), uniform(0, scene_size),
+                    uniform(0, scene_size), 1.0);
+    }
+
+    size_t axis = pick(3);
+    std::array<double, 3> a, b;
+    for (size_t k = 0; k < 3; ++k) {
+      a[k] = k == axis ? 0.0 : uniform(0, scene_size);
+      b[k] = k == axis ? scene_size : uniform(0, scene_size);
+    }
+    return {a[0], a[1], a[2], a[0], a[1], a[2], b[0], b[1], b[2]};
+  }
+
+public:
+  TriangleGenerator(Distribution distribution, size_t count, uint64_t seed)
+      : distribution(distribution), random(seed), count(count),
+        scene_size(5.0 * std::cbrt(static_cast<double>(std::max<size_t>(
+                             count, 1)))) {
+    if (distribution == Distribution::CLUSTERS) {
+      size_t clusters = std::max<size_t>(1, count / 1000);
+      spread = scene_size / (8.0 * std::cbrt(static_cast<double>(clusters)));
+      for (size_t i = 0; i < clusters; ++i) {
+        centres.push_back({uniform(0, scene_size), uniform(0, scene_size),
+                           uniform(0, scene_size)});
+      }
+    } else if (distribution == Distribution::COPLANAR) {
+      // About 2000 triangles per sheet, each overlapping a few neighbours.
+      size_t sheets = std::max<size_t>(2, count / 2000);
+      scene_size = 2.0 * std::sqrt(static_cast<double>(
+                             std::max<size_t>(count / sheets, 1)));
+      for (size_t i = 0; i < sheets; ++i)
+        centres.push_back({std::round(uniform(0, scene_size)), 0.0, 0.0});
+    } else if (distribution == Distribution::GRID) {
+      size_t layers = std::max<size_t>(1, count / 2'000'000);
+      grid_side = static_cast<size_t>(std::ceil(
+          std::sqrt(static_cast<double>(count) / 2.0 / layers)));
+      grid_side = std::max<size_t>(grid_side, 1);
+    }
+  }
+
+  // Coordinates x1 y1 z1 x2 y2 z2 x3 y3 z3 of the next triangle.
+  std::array<double, 9> next() {
+    std::array<double, 9> coordinates{};
+
+    switch (distribution) {
+    case Distribution::UNIFORM:
+      coordinates = around(uniform(0, scene_size), uniform(0, scene_size),
+                           uniform(0, scene_size), 1.0);
+      break;
+    case Distribution::CLUSTERS: {
+      const auto &centre = centres[pick(centres.size())];
+      coordinates = around(normal(centre[0], spread), normal(centre[1], spread),
+                           normal(centre[2], spread), 1.0);
+      break;
+    }
+    case Distribution::COPLANAR:
+      coordinates = coplanar();
+      break;
+    case Distribution::SLIVERS:
+      coordinates = sliver();
+      break;
+    case Distribution::GRID:
+      coordinates = grid();
+      break;
+    case Distribution::DEGENERATE:
+      coordinates = degenerate();
+      break;
+    case Distribution::OCTREE_WORST:
+      coordinates = octree_worst();
+      break;
+    case Distribution::LONG_LINES:
+      coordinates = long_line();
+      break;
+    }
+
+    ++index;
+    return coordinates;
+  }
+
+  size_t size() const { return count; }
+};
+
+// Whole dataset in memory, with ids in generation order.
+template <typename PointTy = double>
+std::vector<Triangle<PointTy>> generate_triangles(Distribution distribution,
+                                                  size_t count,
+                                                  uint64_t seed) {
+  TriangleGenerator generator(distribution, count, seed);
+  std::vector<Triangle<PointTy>> triangles;
+  triangles.reserve(count);
+
+  for (size_t i = 0; i < count; ++i) {
+    std::array<double, 9> c = generator.next();
+    Triangle<PointTy> trg(c[0], c[1], c[2], c[3], c[4], c[5], c[6], c[7],
+                          c[8]);
+    trg.id = i;
+    triangles.push_back(trg);
+  }
+
+  return triangles;
+}
+} // namespace triangle
@@ -0,0 +1,123 @@
+#pragma once
+
+#include "trace.hpp"
+#include "triangles.hpp"
+#include <charconv>
+#include <cstring>
+#include <istream>
+#include <memory>
+#include <vector>
+
+namespace triangle {
+
+// Reads numbers from a stream in blocks and parses them in place with
+// std::from_chars. operator>> for double first copies every number into a
+// std::string, one heap allocation for each coordinate longer than 15
+// characters, and asks the stream for one character at a time.
+class NumberReader {
+  static constexpr size_t block_size = 1 << 16;
+
+  std::streambuf *source;
+  std::unique_ptr<char[]> buffer = std::make_unique<char[]>(block_size);
+  size_t begin = 0, end = 0;
+  bool exhausted = false;
+  bool failed = false;
+
+  static bool is_space(char c) {
+    return c == ' ' || c == '\n' || c == '\t' || c == '\r' || c == '\v' ||
+           c == '\f';
+  }
+
+  // Moves the unread characters to the front and appends the next ones.
+  // Returns false at the end of the stream.
+  bool refill() {
+    if (exhausted)
+      return false;
+
+    std::memmove(buffer.get(), buffer.get() + begin, end - begin);
+    end -= begin;
+    begin = 0;
+    std::streamsize count = source->sgetn(buffer.get() + end,
+                                          block_size - end);
+    if (count <= 0) {
+      exhausted = true;
+      return false;
+    }
+    end += count;
+    return true;
+  }
+
+public:
+  explicit NumberReader(std::istream &in) : source(in.rdbuf()) {}
+
+  // Reads the next whitespace-separated number into value. From the first
+  // malformed or missing number on, returns false and leaves value alone.
+  template <typename Number> bool read(Number &value) {
+    if (failed)
+      return false;
+
+    do {
+      while (begin != end && is_space(buffer[begin]))
+        ++begin;
+    } while (begin == end && refill());
+
+    // The number may go on past the buffer: refill until a space or the
+    // end of the stream follows it.
+    size_t length = 0;
+    while (true) {
+      while (begin + length != end && !is_space(buffer[begin + length]))
+        ++length;
+      if (begin + length != end || length == block_size || !refill())
+        break;
+    }
+
+    const char *first = buffer.get() + begin;
+    const char *last = first + length;
+    if (first != last && *first == '+')
+      ++first;
+    Number number{};
+    auto [stop, error] = std::from_chars(first, last, number);
+    if (first == last || error != std::errc() || stop != last ||
+        length == block_size) {
+      failed = true;
+      return false;
+    }
+
+    value = number;
+    begin += length;
+    return true;
+  }
+};
+
+// Reads the number of triangles followed by 9 coordinates per triangle.
+// Triangle ids are their positions in the input.
+template <typename PointTy = double>
+std::vector<Triangle<PointTy>> read_triangles(std::istream &in) {
+  std::vector<Triangle<PointTy>> input;
+  NumberReader reader(in);
+  size_t triag_num = 0;
+  reader.read(triag_num);
+  input.reserve(triag_num);
+
+  // Chunks only group the trace spans.
+  constexpr size_t chunk_size = 1 << 16;
+
+  for (size_t chunk = 0; chunk * chunk_size < triag_num; ++chunk) {
+    trace::Span span("parse_chunk", chunk);
+    size_t end = std::min(triag_num, (chunk + 1) * chunk_size);
+
+    for (size_t i = chunk * chunk_size; i < end; ++i) {
+      PointTy coordinates[9] = {};
+      for (PointTy &coordinate : coordinates)
+        reader.read(coordinate);
+
+      auto [x1, y1, z1, x2, y2, z2, x3, y3, z3] = coordinates;
+      Triangle<PointTy> triangle(x1, y1, z1, x2, y2, z2, x3, y3, z3);
+      triangle.id = i;
+      input.push_back(triangle);
+    }
+  }
+
+  return input;
+}
+} // namespace triangle
@@ -0,0 +1,258 @@
+#pragma once
+
+#include "arena.hpp"
+#include "brute_force.hpp"
+#include "bvh8.hpp"
+#include "bvtt.hpp"
+#include "coplanar.hpp"
+#include "degenerate.hpp"
+#include "kdtree.hpp"
+#include "lbvh.hpp"
+#include "loose_octree.hpp"
+#include "morton.hpp"
+#include "octotree.hpp"
+#include "parallel.hpp"
+#include "stats.hpp"
+#include "trace.hpp"
+#include <atomic>
+#include <optional>
+#include <string_view>
+
+namespace triangle {
+
+// Broad phases that produce the candidate pairs.
+enum class Engine {
+  OCTOTREE,    // Midpoint octree, pairs tested inside each cell
+  BRUTE_FORCE, // All pairs with a bounding box filter, the reference oracle
+  LBVH,        // Linear BVH over Morton-sorted triangles, one query per leaf
+  BVTT,        // The same tree against itself, descending pairs of nodes
+  LOOSE,       // Loose octree, every triangle stored once at its size's level
+  KDTREE,      // kd-tree with split planes chosen by the surface area heuristic
+  BVH8,        // Linear BVH collapsed to 8-wide nodes, tested 8 boxes at once
+};
+
+inline constexpr Engine all_engines[] = {Engine::OCTOTREE,
+                                         Engine::BRUTE_FORCE, Engine::LBVH,
+                                         Engine::BVTT, Engine::LOOSE,
+                                         Engine::KDTREE, Engine::BVH8};
+
+inline const char *engine_name(Engine engine) {
+  switch (engine) {
+  case Engine::OCTOTREE:
+    return "octotree";
+  case Engine::BRUTE_FORCE:
+    return "brute";
+  case Engine::LBVH:
+    return "lbvh";
+  case Engine::BVTT:
+    return "bvtt";
+  case Engine::LOOSE:
+    return "loose";
+  case Engine::KDTREE:
+    return "kdtree";
+  case Engine::BVH8:
+    return "bvh8";
+  }
+  return "unknown";
+}
+
+inline std::optional<Engine> parse_engine(std::string_view name) {
+  for (Engine engine : all_engines) {
+    if (name == engine_name(engine))
+      return engine;
+  }
+  return std::nullopt;
+}
+
+inline constexpr Kernel all_kernels[] = {Kernel::INTERVALS,
+                                         Kernel::ORIENTATION};
+
+inline const char *kernel_name(Kernel kernel) {
+  switch (kernel) {
+  case Kernel::INTERVALS:
+    return "intervals";
+  case Kernel::ORIENTATION:
+    return "orient";
+  }
+  return "unknown";
+}
+
+inline std::optional<Kernel> parse_kernel(std::string_view name) {
+  for (Kernel kernel : all_kernels) {
+    if (name == kernel_name(kernel))
+      return kernel;
+  }
+  return std::nullopt;
+}
+
+struct SearchOptions {
+  Engine engine = Engine::OCTOTREE;
+  size_t threads = 1;
+  // Triangle-triangle test of the engine's narrow phase.
+  Kernel kernel = Kernel::INTERVALS;
+};
+
+// Builds the octree over input and calls on_pair(one, two, worker) for every
+// intersecting pair, once, on threads workers. A pair straddling several
+// cells is tested only in the cell that owns it. K is the triangle-triangle
+// kernel.
+template <Kernel K = Kernel::INTERVALS, typename PointTy = double,
+          typename PairFn>
+void octotree_pairs(const std::vector<Triangle<PointTy>> &input,
+                    size_t threads, PairFn &&on_pair) {
+  std::optional<Octotree<PointTy>> octotree;
+  {
+    stats::Phase phase("build");
+    octotree.emplace(input, calculate_octotree_depth(input.size()));
+    octotree->divide_tree();
+  }
+
+  std::pmr::deque<BoundingBox<PointTy>> &cells = octotree->get_cells();
+
+  if (stats::enabled()) {
+    stats::tree.triangles = input.size();
+    for (auto &cell : cells)
+      stats::tree.add_cell(cell.get_trg_in_cell().size());
+  }
+
+  stats::Phase phase("narrow");
+  std::vector<Arena> arenas(resolve_threads(threads));
+  parallel_for(cells.size(), threads, [&](size_t cell, size_t worker) {
+    trace::Span span("cell", cells[cell].get_trg_in_cell().size());
+    auto report = [&](const Triangle<PointTy> &one,
+                      const Triangle<PointTy> &two) {
+      on_pair(one, two, worker);
+    };
+
+    cells[cell].template for_each_owned_intersection<K>(
+        report, arenas[worker].resource());
+    arenas[worker].release();
+  });
+}
+
+template <typename PointTy = double, typename PairFn>
+void run_engine(const std::vector<Triangle<PointTy>> &input,
+                const SearchOptions &options, size_t threads,
+                PairFn &&on_pair) {
+  if (input.empty())
+    return;
+
+  // The kernel is a template parameter of the loops, chosen once here.
+  auto with_kernel = [&]<Kernel K>() {
+    switch (options.engine) {
+    case Engine::OCTOTREE:
+      octotree_pairs<K>(input, threads, on_pair);
+      break;
+    case Engine::BRUTE_FORCE:
+      brute_force_pairs<K>(input, threads, on_pair);
+      break;
+    case Engine::LBVH:
+      lbvh_pairs<K>(input, threads, on_pair);
+      break;
+    case Engine::BVTT:
+      bvtt_pairs<K>(input, threads, on_pair);
+      break;
+    case Engine::LOOSE:
+      loose_octree_pairs<K>(input, threads, on_pair);
+      break;
+    case Engine::KDTREE:
+      kdtree_pairs<K>(input, threads, on_pair);
+      break;
+    case Engine::BVH8:
+      bvh8_pairs<K>(input, threads, on_pair);
+      break;
+    }
+  };
+
+  switch (options.kernel) {
+  case Kernel::INTERVALS:
+    with_kernel.template operator()<Kernel::INTERVALS>();
+    break;
+  case Kernel::ORIENTATION:
+    with_kernel.template operator()<Kernel::ORIENTATION>();
+    break;
+  }
+}
+
+// Calls on_pair(one, two, worker) once for every intersecting pair of input
+// found by the selected engine. worker is in [0, threads) and may be used to
+// index per-thread state; on_pair is called concurrently from different
+// workers.
+//
+// Pairs with a POINT or LINE operand are found by degenerate_pairs() and
+// pairs of coplanar triangles by coplanar_pairs(); the engine only gets the
+// real triangles and skips pairs within a coplanar group. The brute force
+// oracle takes the whole input, so it does not depend on these stages.
+template <typename PointTy = double, typename PairFn>
+void find_intersecting_pairs(const std::vector<Triangle<PointTy>> &input,
+                             const SearchOptions &options, PairFn &&on_pair) {
+  using TYPE = typename Triangle<PointTy>::TriangleType;
+
+  if (input.empty())
+    return;
+
+  size_t threads = resolve_threads(options.threads);
+
+  if (options.engine == Engine::BRUTE_FORCE) {
+    run_engine(input, options, threads, on_pair);
+    return;
+  }
+
+  std::vector<uint32_t> points, lines, solids;
+  {
+    stats::Phase phase("classify");
+    for (size_t i = 0; i < input.size(); ++i) {
+      switch (input[i].get_type()) {
+      case TYPE::POINT:
+        points.push_back(i);
+        break;
+      case TYPE::LINE:
+        lines.push_back(i);
+        break;
+      case TYPE::TRIANGLE:
+        solids.push_back(i);
+        break;
+      default:
+        break;
+      }
+    }
+  }
+
+  if (solids.size() != input.size())
+    degenerate_pairs(input, points, lines, solids, threads, on_pair);
+
+  // The real triangles, along the Morton curve through their centroids:
+  // the engine copies them into its cells in this order, so triangles close
+  // in space end up close in memory. Ids stay those of the input.
+  std::vector<Triangle<PointTy>> solid_input;
+  {
+    stats::Phase phase("reorder");
+    std::vector<uint32_t> order = morton_order(input, solids, threads);
+    solid_input.reserve(solids.size());
+    for (uint32_t position : order)
+      solid_input.push_back(input[solids[position]]);
+  }
+
+  coplanar_pairs(solid_input, threads, on_pair);
+  run_engine(solid_input, options, threads, on_pair);
+}
+
+// Flags of the triangles (by id) that intersect at least one other triangle.
+template <typename PointTy = double>
+std::vector<std::atomic<bool>>
+find_intersecting(const std::vector<Triangle<PointTy>> &input,
+                  const SearchOptions &options = {}) {
+  std::vector<std::atomic<bool>> intersecting(input.size());
+
+  find_intersecting_pairs(input, options,
+                          [&](const Triangle<PointTy> &one,
+                              const Triangle<PointTy> &two, size_t) {
+                            intersecting[one.id].store(
+                                true, std::memory_order_relaxed);
+                            intersecting[two.id].store(
+                                true, std::memory_order_relaxed);
+                          });
+
+  return intersecting;
+}
+} // namespace triangle
@@ -1,7 +1,7 @@
 #pragma once
 
 #include "point.hpp"
-#include <vector>
+#include "vector.hpp"
 
 namespace triangle {
 template <typename PointTy> class Triangle;
@@ -33,54 +33,85 @@ public:
   }
 };
 
+// Distance between the intervals along the line, negative if they overlap.
 template <typename PointTy = double>
-bool intersect_intervals(Interval<PointTy> &int1, Interval<PointTy> &int2) {
-  PointTy int1_min = std::min(int1.get_p1().x, int1.get_p2().x);
-  PointTy int1_max = std::max(int1.get_p1().x, int1.get_p2().x);
-  PointTy int2_min = std::min(int2.get_p1().x, int2.get_p2().x);
-  PointTy int2_max = std::max(int2.get_p1().x, int2.get_p2().x);
-
-  if (cmp(int1_min, int2_min) || cmp(int1_min, int2_max) ||
-      cmp(int1_max, int2_min) || cmp(int1_max, int2_max)) {
-    return true;
-  }
-  if ((int1_min >= int2_min && int1_min <= int2_max) ||
-      (int1_max >= int2_min && int1_max <= int2_max) ||
-      (int2_min >= int1_min && int2_min <= int1_max)) {
-    return true;
+PointTy interval_gap(const Interval<PointTy> &int1,
+                     const Interval<PointTy> &int2) {
+  // All four ends lie on one line, so the intervals are compared along the
+  // axis where they spread the most: on the others the line may be constant.
+  auto coordinate = [](const Point<PointTy> &point, int axis) {
+    return axis == 0 ? point.x : (axis == 1 ? point.y : point.z);
+  };
+
+  const Point<PointTy> ends[] = {int1.get_p1(), int1.get_p2(), int2.get_p1(),
+                                 int2.get_p2()};
+  int axis = 0;
+  PointTy best_spread = -1;
+  for (int candidate = 0; candidate < 3; ++candidate) {
+    PointTy low = coordinate(ends[0], candidate);
+    PointTy high = low;
+    for (const auto &end : ends) {
+      low = std::min(low, coordinate(end, candidate));
+      high = std::max(high, coordinate(end, candidate));
+    }
+    if (high - low > best_spread) {
+      best_spread = high - low;
+      axis = candidate;
+    }
   }
 
-  return false;
+  PointTy int1_min = std::min(coordinate(ends[0], axis), coordinate(ends[1], axis));
+  PointTy int1_max = std::max(coordinate(ends[0], axis), coordinate(ends[1], axis));
+  PointTy int2_min = std::min(coordinate(ends[2], axis), coordinate(ends[3], axis));
+  PointTy int2_max = std::max(coordinate(ends[2], axis), coordinate(ends[3], axis));
+
+  return std::max(int1_min, int2_min) - std::min(int1_max, int2_max);
+}
+
+// The intervals overlap or their ends are within epsilon_.
+template <typename PointTy = double>
+bool intersect_intervals(const Interval<PointTy> &int1,
+                         const Interval<PointTy> &int2) {
+  return interval_gap(int1, int2) <= epsilon_;
 }
 
 template <typename PointTy = double>
 Interval<PointTy> get_valid_interval_of_triangle_and_line(
     const Triangle<PointTy> &triangle, const Point<PointTy> &inter_point1,
     const Point<PointTy> &inter_point2, const Point<PointTy> &inter_point3) {
-  std::vector<Point<PointTy>> valid_points;
+  // At most three, kept on the stack: this runs for every pair.
+  Point<PointTy> valid_points[3];
+  size_t count = 0;
 
   if (point_in_triangle(triangle, inter_point1))
-    valid_points.push_back(inter_point1);
+    valid_points[count++] = inter_point1;
 
   if (point_in_triangle(triangle, inter_point2))
-    valid_points.push_back(inter_point2);
+    valid_points[count++] = inter_point2;
 
-  if (point_in_triangle(triangle, inter_point3)) {
-    valid_points.push_back(inter_point3);
-  }
+  if (point_in_triangle(triangle, inter_point3))
+    valid_points[count++] = inter_point3;
 
-  if (valid_points.size() == 2)
+  if (count == 2)
     return Interval<PointTy>{valid_points[0], valid_points[1]};
 
-  if (valid_points.size() == 3) {
-    if (equal(valid_points[0], valid_points[1])) {
-      return Interval<PointTy>{valid_points[0], valid_points[2]};
-    }
-
-    if ((equal(valid_points[0], valid_points[2])) ||
-        (equal(valid_points[1], valid_points[2]))) {
-      return Interval<PointTy>{valid_points[0], valid_points[1]};
-    }
+  // The line passes through a vertex, so two of the points (nearly)
+  // coincide. All three lie on the line: the two farthest apart span it.
+  if (count == 3) {
+    auto distance = [&](size_t i, size_t j) {
+      Vector<PointTy> gap = valid_points[i] - valid_points[j];
+      return dot(gap, gap);
+    };
+
+    size_t skip = 2;
+    if (distance(0, 2) > distance(0, 1) && distance(0, 2) >= distance(1, 2))
+      skip = 1;
+    else if (distance(1, 2) > distance(0, 1) &&
+             distance(1, 2) > distance(0, 2))
+      skip = 0;
+
+    return Interval<PointTy>{valid_points[skip == 0 ? 1 : 0],
+                             valid_points[skip == 2 ? 1 : 2]};
   }
 
   return Interval<PointTy>{};
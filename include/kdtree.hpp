@@ -0,0 +1,303 @@
+#pragma once
+
+#include "box.hpp"
+#include "parallel.hpp"
+#include "stats.hpp"
+#include "trace.hpp"
+#include "triangles.hpp"
+#include <algorithm>
+#include <cstdint>
+#include <limits>
+#include <optional>
+#include <utility>
+#include <vector>
+
+namespace triangle {
+
+// kd-tree whose split planes are chosen among the faces of the triangle
+// boxes by the surface area heuristic (Wald and Havran, "On building fast
+// kd-trees for ray tracing, and on doing that in O(N log^2 N)", 2006). On
+// every axis a sweep over the sorted faces counts the boxes on each side of
+// every candidate plane, and the plane of the lowest
+//   traversal_cost + (area_left * left + area_right * right) / area
+// wins. Unlike the midpoint of Octotree, the plane follows the triangles, so
+// thin plates and long corridors are not cut through empty space.
+//
+// A node stays a leaf when testing all its pairs is cheaper than handing
+// its triangles down and testing the pairs of both children; a triangle
+// straddling the plane goes to both. As in Octotree, every leaf is
+// responsible for a region [lower, upper) and owns the pairs whose box
+// overlap has its minimum corner there, so each pair is tested once.
+template <typename PointTy = double> class KdTree {
+public:
+  static constexpr size_t max_depth = 48;
+
+  // Of a node against one box test, in the surface area heuristic.
+  static constexpr PointTy traversal_cost = 1;
+  // Of handing one triangle down to a child against one box test of a pair
+  // in a leaf, in the termination test.
+  static constexpr PointTy descend_cost = 4;
+
+private:
+  struct Leaf {
+    Box<PointTy> region;
+    uint32_t begin, end; // In leaf_items
+  };
+
+  struct Split {
+    int axis = -1;
+    PointTy position = 0;
+    PointTy cost = std::numeric_limits<PointTy>::infinity();
+    size_t left = 0, right = 0;
+  };
+
+  // Lower or upper face of the box of a triangle on one axis.
+  struct Face {
+    PointTy position;
+    uint32_t id;
+
+    bool operator<(const Face &other) const {
+      return position < other.position;
+    }
+  };
+
+  // Faces of the triangles of a node, sorted on every axis. Children get
+  // theirs by stable filtering, so faces are sorted once, at the root.
+  struct Faces {
+    std::vector<Face> lower[3], upper[3];
+
+    size_t size() const { return lower[0].size(); }
+  };
+
+  // Where a triangle goes at the current split.
+  enum Side : uint8_t { LEFT = 1, RIGHT = 2 };
+
+  std::vector<Triangle<PointTy>> triangles;
+  std::vector<Box<PointTy>> boxes; // Of triangles
+  std::vector<uint8_t> sides;      // Of triangles, at the node being split
+  std::vector<Leaf> leaves;
+  std::vector<uint32_t> leaf_items; // Triangles of every leaf
+
+  static PointTy area(const Box<PointTy> &box) {
+    PointTy x = box.upper[0] - box.lower[0];
+    PointTy y = box.upper[1] - box.lower[1];
+    PointTy z = box.upper[2] - box.lower[2];
+    return 2 * (x * y + y * z + z * x);
+  }
+
+  static PointTy pairs(size_t count) {
+    return count < 2 ? 0 : static_cast<PointTy>(count) * (count - 1) / 2;
+  }
+
+  // The best plane by the surface area heuristic inside extent, which has a
+  // positive area, from one sweep over the sorted faces on every axis. A box
+  // goes left if it starts before the plane and right if it ends at or
+  // after it.
+  static Split find_split(const Faces &faces, const Box<PointTy> &extent) {
+    size_t count = faces.size();
+    PointTy whole = area(extent);
+
+    Split best;
+    for (int axis = 0; axis < 3; ++axis) {
+      const std::vector<Face> &starts = faces.lower[axis];
+      const std::vector<Face> &ends = faces.upper[axis];
+      Box<PointTy> left = extent, right = extent;
+
+      // started and ended count the faces before plane.
+      size_t started = 0, ended = 0;
+      while (started < count || ended < count) {
+        PointTy plane = std::min(
+            started < count ? starts[started].position
+                            : std::numeric_limits<PointTy>::infinity(),
+            ended < count ? ends[ended].position
+                          : std::numeric_limits<PointTy>::infinity());
+
+        if (plane > extent.lower[axis] && plane < extent.upper[axis]) {
+          left.upper[axis] = right.lower[axis] = plane;
+          PointTy cost = traversal_cost + (area(left) * started +
+                                           area(right) * (count - ended)) /
+                                              whole;
+          if (cost < best.cost)
+            best = Split{axis, plane, cost, started, count - ended};
+        }
+
+        while (started < count && starts[started].position == plane)
+          ++started;
+        while (ended < count && ends[ended].position == plane)
+          ++ended;
+      }
+    }
+    return best;
+  }
+
+  void make_leaf(const Faces &faces, const Box<PointTy> &region) {
+    uint32_t begin = leaf_items.size();
+    for (const Face &face : faces.lower[0])
+      leaf_items.push_back(face.id);
+    leaves.push_back(
+        Leaf{region, begin, static_cast<uint32_t>(leaf_items.size())});
+  }
+
+  void build(Faces faces, const Box<PointTy> &region, size_t depth) {
+    size_t count = faces.size();
+
+    // Boxes of the triangles clipped to the region.
+    Box<PointTy> extent;
+    for (int axis = 0; axis < 3; ++axis) {
+      extent.lower[axis] =
+          std::max(faces.lower[axis].front().position, region.lower[axis]);
+      extent.upper[axis] =
+          std::min(faces.upper[axis].back().position, region.upper[axis]);
+    }
+
+    Split split;
+    if (depth < max_depth && count > 2 && area(extent) > 0)
+      split = find_split(faces, extent);
+
+    if (split.axis < 0 || descend_cost * (split.left + split.right) +
+                                  pairs(split.left) + pairs(split.right) >=
+                              pairs(count)) {
+      make_leaf(faces, region);
+      return;
+    }
+
+    int axis = split.axis;
+    for (const Face &face : faces.lower[axis]) {
+      const Box<PointTy> &box = boxes[face.id];
+      sides[face.id] = (box.lower[axis] < split.position ? LEFT : 0) |
+                       (box.upper[axis] >= split.position ? RIGHT : 0);
+    }
+
+    Faces left, right;
+    auto distribute = [&](std::vector<Face> &list, std::vector<Face> &to_left,
+                          std::vector<Face> &to_right) {
+      to_left.reserve(split.left);
+      to_right.reserve(split.right);
+      for (const Face &face : list) {
+        if (sides[face.id] & LEFT)
+          to_left.push_back(face);
+        if (sides[face.id] & RIGHT)
+          to_right.push_back(face);
+      }
+      std::vector<Face>().swap(list);
+    };
+    for (int list_axis = 0; list_axis < 3; ++list_axis) {
+      distribute(faces.lower[list_axis], left.lower[list_axis],
+                 right.lower[list_axis]);
+      distribute(faces.upper[list_axis], left.upper[list_axis],
+                 right.upper[list_axis]);
+    }
+
+    Box<PointTy> left_region = region, right_region = region;
+    left_region.upper[axis] = right_region.lower[axis] = split.position;
+    build(std::move(left), left_region, depth + 1);
+    build(std::move(right), right_region, depth + 1);
+  }
+
+public:
+  // Boxes are widened by half the margin of brute_force_pairs(), so that
+  // two of them overlap if the triangles are within 16 * epsilon_.
+  explicit KdTree(const std::vector<Triangle<PointTy>> &input)
+      : triangles(input) {
+    if (input.empty())
+      return;
+
+    boxes.reserve(input.size());
+    for (const auto &trg : input)
+      boxes.emplace_back(trg, 8 * epsilon_);
+
+    Box<PointTy> region;
+    std::fill(region.lower, region.lower + 3,
+              -std::numeric_limits<PointTy>::infinity());
+    std::fill(region.upper, region.upper + 3,
+              std::numeric_limits<PointTy>::infinity());
+
+    Faces faces;
+    for (int axis = 0; axis < 3; ++axis) {
+      faces.lower[axis].reserve(input.size());
+      faces.upper[axis].reserve(input.size());
+      for (uint32_t id = 0; id < input.size(); ++id) {
+        faces.lower[axis].push_back(Face{boxes[id].lower[axis], id});
+        faces.upper[axis].push_back(Face{boxes[id].upper[axis], id});
+      }
+      std::sort(faces.lower[axis].begin(), faces.lower[axis].end());
+      std::sort(faces.upper[axis].begin(), faces.upper[axis].end());
+    }
+
+    sides.resize(input.size());
+    build(std::move(faces), region, 0);
+  }
+
+  size_t leaf_count() const { return leaves.size(); }
+
+  size_t leaf_size(size_t leaf) const {
+    return leaves[leaf].end - leaves[leaf].begin;
+  }
+
+  std::vector<Triangle<PointTy>> &get_triangles() { return triangles; }
+
+  const Box<PointTy> &get_box(uint32_t id) const { return boxes[id]; }
+
+  // Calls visit(one, two) for every pair of triangles with overlapping boxes
+  // that leaf owns; over all leaves, every such pair is visited once.
+  template <typename PairFn>
+  void for_each_overlap(size_t index, PairFn &&visit) const {
+    const Leaf &leaf = leaves[index];
+    for (uint32_t i = leaf.begin; i < leaf.end; ++i) {
+      const Box<PointTy> &box = boxes[leaf_items[i]];
+      for (uint32_t j = i + 1; j < leaf.end; ++j) {
+        const Box<PointTy> &other = boxes[leaf_items[j]];
+        if (!box.overlaps(other))
+          continue;
+
+        bool owned = true;
+        for (int axis = 0; axis < 3; ++axis) {
+          PointTy corner = std::max(box.lower[axis], other.lower[axis]);
+          owned &= (corner >= leaf.region.lower[axis]) &
+                   (corner < leaf.region.upper[axis]);
+        }
+        if (owned)
+          visit(leaf_items[i], leaf_items[j]);
+        else
+          TRIAG_STAT_DUPLICATE_PAIR();
+      }
+    }
+  }
+};
+
+// Builds a KdTree over input and calls on_pair(one, two, worker) for every
+// intersecting pair, once, on threads workers, one leaf per work item. Pairs
+// within a coplanar group are skipped. K is the triangle-triangle kernel.
+template <Kernel K = Kernel::INTERVALS, typename PointTy = double,
+          typename PairFn>
+void kdtree_pairs(const std::vector<Triangle<PointTy>> &input, size_t threads,
+                  PairFn &&on_pair) {
+  std::optional<KdTree<PointTy>> tree;
+  {
+    stats::Phase phase("build");
+    tree.emplace(input);
+  }
+
+  if (stats::enabled()) {
+    stats::tree.triangles = input.size();
+    for (size_t leaf = 0; leaf < tree->leaf_count(); ++leaf)
+      stats::tree.add_cell(tree->leaf_size(leaf));
+  }
+
+  std::vector<Triangle<PointTy>> &triangles = tree->get_triangles();
+
+  stats::Phase phase("narrow");
+  parallel_for(tree->leaf_count(), threads, [&](size_t leaf, size_t worker) {
+    trace::Span span("leaf", tree->leaf_size(leaf));
+    tree->for_each_overlap(leaf, [&](uint32_t first, uint32_t second) {
+      Triangle<PointTy> &one = triangles[first];
+      Triangle<PointTy> &two = triangles[second];
+      if (same_plane_group(one, two))
+        return;
+
+      if (check_intersection<K>(one, two))
+        on_pair(one, two, worker);
+    });
+  });
+}
+} // namespace triangle
@@ -0,0 +1,289 @@
+#pragma once
+
+#include "box.hpp"
+#include "morton.hpp"
+#include "parallel.hpp"
+#include "stats.hpp"
+#include "trace.hpp"
+#include "triangles.hpp"
+#include <algorithm>
+#include <atomic>
+#include <bit>
+#include <cstdint>
+#include <numeric>
+#include <optional>
+#include <vector>
+
+namespace triangle {
+
+// Linear BVH (Karras, "Maximizing parallelism in the construction of BVHs,
+// octrees, and k-d trees", 2012). The triangles are sorted by the Morton
+// codes of their centroids and become the leaves, in that order. The n - 1
+// internal nodes form a binary radix tree over the codes: each of them finds
+// its key range and split by binary searches on the longest common prefix
+// of codes, independently of all others, so the whole topology is built in
+// one parallel pass. The boxes are then refitted bottom-up: the second of
+// the two children to arrive at a node merges their boxes and goes on.
+//
+// Nodes are numbered in one space: internal nodes [0, n - 1) with the root
+// at 0, then leaves [n - 1, 2n - 1). A single triangle is a lone leaf root.
+template <typename PointTy = double> class LinearBVH {
+  static constexpr uint32_t no_parent = UINT32_MAX;
+
+  // Children, and the range [first, last] of leaves below.
+  struct Node {
+    uint32_t left, right;
+    uint32_t first, last;
+  };
+
+  std::vector<Triangle<PointTy>> leaves; // In Morton order
+  std::vector<uint64_t> codes;           // Sorted, one per leaf
+  std::vector<Node> nodes;               // Internal nodes
+  std::vector<uint32_t> parents;         // Of every node
+  std::vector<Box<PointTy>> boxes;       // Of every node
+
+  uint32_t leaf_node(uint32_t leaf) const { return nodes.size() + leaf; }
+
+  // Length of the common prefix of the keys of leaves i and j, or -1 if j is
+  // out of range. Equal codes are told apart by the leaf index.
+  int common_prefix(int64_t i, int64_t j) const {
+    if (j < 0 || j >= static_cast<int64_t>(codes.size()))
+      return -1;
+    uint64_t diff = codes[i] ^ codes[j];
+    if (diff != 0)
+      return std::countl_zero(diff);
+    return 64 + std::countl_zero(static_cast<uint32_t>(i ^ j));
+  }
+
+  // Karras' construction of internal node i: the direction and the other end
+  // of its range, then the split inside it.
+  void build_node(int64_t i) {
+    int direction = common_prefix(i, i + 1) > common_prefix(i, i - 1) ? 1 : -1;
+    int prefix_min = common_prefix(i, i - direction);
+
+    int64_t length_max = 2;
+    while (common_prefix(i, i + length_max * direction) > prefix_min)
+      length_max *= 2;
+
+    int64_t length = 0;
+    for (int64_t step = length_max / 2; step >= 1; step /= 2) {
+      if (common_prefix(i, i + (length + step) * direction) > prefix_min)
+        length += step;
+    }
+    int64_t j = i + length * direction;
+
+    int prefix_node = common_prefix(i, j);
+    int64_t split = 0;
+    for (int64_t step = length; step > 1;) {
+      step = (step + 1) / 2;
+      if (common_prefix(i, i + (split + step) * direction) > prefix_node)
+        split += step;
+    }
+    split = i + split * direction + std::min(direction, 0);
+
+    Node &node = nodes[i];
+    node.first = std::min(i, j);
+    node.last = std::max(i, j);
+    node.left = node.first == split ? leaf_node(split) : split;
+    node.right = node.last == split + 1 ? leaf_node(split + 1) : split + 1;
+    parents[node.left] = i;
+    parents[node.right] = i;
+  }
+
+public:
+  // Boxes are widened by half the margin of brute_force_pairs(), so that
+  // two of them overlap if the triangles are within 16 * epsilon_.
+  LinearBVH(const std::vector<Triangle<PointTy>> &input, size_t threads) {
+    size_t size = input.size();
+    if (size == 0)
+      return;
+
+    {
+      std::vector<uint32_t> ids(size);
+      std::iota(ids.begin(), ids.end(), 0);
+      std::vector<uint64_t> unsorted = morton_codes(input, ids, threads);
+      std::vector<uint32_t> order = radix_sort_order(unsorted, threads);
+
+      leaves.reserve(size);
+      codes.reserve(size);
+      for (uint32_t id : order) {
+        leaves.push_back(input[id]);
+        codes.push_back(unsorted[id]);
+      }
+    }
+
+    nodes.resize(size - 1);
+    parents.assign(2 * size - 1, no_parent);
+    boxes.resize(2 * size - 1);
+
+    Blocks internal(nodes.size(), threads);
+    parallel_for(internal.count, threads, [&](size_t block, size_t) {
+      for (size_t i = internal.begin(block); i < internal.end(block); ++i)
+        build_node(i);
+    });
+
+    // Every leaf walks up while it is the second child to arrive; the
+    // acquire-release counter makes the box of the first one visible.
+    std::vector<std::atomic<uint32_t>> arrived(nodes.size());
+    Blocks leaf_blocks(size, threads);
+    parallel_for(leaf_blocks.count, threads, [&](size_t block, size_t) {
+      for (size_t k = leaf_blocks.begin(block); k < leaf_blocks.end(block);
+           ++k) {
+        uint32_t node = leaf_node(k);
+        boxes[node] = Box<PointTy>(leaves[k], 8 * epsilon_);
+
+        for (node = parents[node]; node != no_parent; node = parents[node]) {
+          if (arrived[node].fetch_add(1, std::memory_order_acq_rel) == 0)
+            break;
+          boxes[node] =
+              Box<PointTy>(boxes[nodes[node].left], boxes[nodes[node].right]);
+        }
+      }
+    });
+  }
+
+  size_t size() const { return leaves.size(); }
+
+  std::vector<Triangle<PointTy>> &get_leaves() { return leaves; }
+
+  // Nodes, for traversals of their own: the root is 0, internal nodes have
+  // two children, a leaf node stands for one leaf.
+  bool is_leaf(uint32_t node) const { return node >= nodes.size(); }
+
+  uint32_t get_left(uint32_t node) const { return nodes[node].left; }
+
+  uint32_t get_right(uint32_t node) const { return nodes[node].right; }
+
+  uint32_t get_leaf(uint32_t node) const { return node - nodes.size(); }
+
+  size_t leaf_count(uint32_t node) const {
+    return is_leaf(node) ? 1 : nodes[node].last - nodes[node].first + 1;
+  }
+
+  uint32_t first_leaf(uint32_t node) const {
+    return is_leaf(node) ? get_leaf(node) : nodes[node].first;
+  }
+
+  uint32_t last_leaf(uint32_t node) const {
+    return is_leaf(node) ? get_leaf(node) : nodes[node].last;
+  }
+
+  // Up to width nodes that together hold the leaves of node, in leaf order,
+  // for collapsing into a wide tree: starting from the children of node, the
+  // internal one with the largest surface area is replaced by its children
+  // while there are fewer than width. Returns their count.
+  int collapse(uint32_t node, uint32_t *children, int width) const {
+    auto area = [&](uint32_t child) {
+      const Box<PointTy> &box = boxes[child];
+      PointTy x = box.upper[0] - box.lower[0];
+      PointTy y = box.upper[1] - box.lower[1];
+      PointTy z = box.upper[2] - box.lower[2];
+      return x * y + y * z + z * x;
+    };
+
+    int count = 0;
+    if (is_leaf(node)) {
+      children[count++] = node;
+      return count;
+    }
+    children[count++] = get_left(node);
+    children[count++] = get_right(node);
+
+    while (count < width) {
+      int widest = -1;
+      for (int k = 0; k < count; ++k) {
+        if (!is_leaf(children[k]) &&
+            (widest < 0 || area(children[k]) > area(children[widest])))
+          widest = k;
+      }
+      if (widest < 0)
+        break;
+
+      uint32_t split = children[widest];
+      std::copy_backward(children + widest + 1, children + count,
+                         children + count + 1);
+      children[widest] = get_left(split);
+      children[widest + 1] = get_right(split);
+      ++count;
+    }
+    return count;
+  }
+
+  const Box<PointTy> &get_box(uint32_t node) const { return boxes[node]; }
+
+  const Box<PointTy> &get_leaf_box(uint32_t leaf) const {
+    return boxes[leaf_node(leaf)];
+  }
+
+  // Calls visit(other) for every leaf other > leaf whose box overlaps the
+  // one of leaf. Subtrees entirely at or below leaf are skipped, so every
+  // overlapping pair of leaves is visited once, from its smaller leaf.
+  template <typename LeafFn>
+  void for_each_overlap(uint32_t leaf, LeafFn &&visit) const {
+    if (nodes.empty())
+      return;
+
+    const Box<PointTy> &box = get_leaf_box(leaf);
+    auto range_last = [&](uint32_t node) {
+      return node < nodes.size() ? nodes[node].last : node - nodes.size();
+    };
+
+    // The tree is at most 96 levels deep: 64 bits of code and 32 of index.
+    uint32_t stack[128];
+    size_t top = 0;
+    stack[top++] = 0;
+
+    while (top != 0) {
+      const Node &node = nodes[stack[--top]];
+      for (uint32_t child : {node.left, node.right}) {
+        if (range_last(child) <= leaf || !boxes[child].overlaps(box))
+          continue;
+
+        if (child < nodes.size())
+          stack[top++] = child;
+        else
+          visit(child - static_cast<uint32_t>(nodes.size()));
+      }
+    }
+  }
+};
+
+// Builds a LinearBVH over input and calls on_pair(one, two, worker) for every
+// intersecting pair, once, on threads workers. Leaves are traversed in runs
+// of consecutive ones, which are close in space and so walk the same parts
+// of the tree. Pairs within a coplanar group are skipped. K is the
+// triangle-triangle kernel.
+template <Kernel K = Kernel::INTERVALS, typename PointTy = double,
+          typename PairFn>
+void lbvh_pairs(const std::vector<Triangle<PointTy>> &input, size_t threads,
+                PairFn &&on_pair) {
+  constexpr size_t run = 64;
+
+  std::optional<LinearBVH<PointTy>> bvh;
+  {
+    stats::Phase phase("build");
+    bvh.emplace(input, threads);
+  }
+
+  std::vector<Triangle<PointTy>> &leaves = bvh->get_leaves();
+  size_t runs = (leaves.size() + run - 1) / run;
+
+  stats::Phase phase("narrow");
+  parallel_for(runs, threads, [&](size_t index, size_t worker) {
+    trace::Span span("leaves", index);
+
+    size_t end = std::min(leaves.size(), (index + 1) * run);
+    for (size_t leaf = index * run; leaf < end; ++leaf) {
+      Triangle<PointTy> &one = leaves[leaf];
+      bvh->for_each_overlap(leaf, [&](uint32_t other) {
+        Triangle<PointTy> &two = leaves[other];
+        if (same_plane_group(one, two))
+          return;
+
+        if (check_intersection<K>(one, two))
+          on_pair(one, two, worker);
+      });
+    }
+  });
+}
+} // namespace triangle
@@ -42,17 +42,25 @@ Point<PointTy> intersect_line_with_line(const Line<PointTy> &line1,
   PointTy C = dot(line2.vector, line2.vector);
   PointTy D = dot(line1.vector, line1.point - line2.point);
   PointTy E = dot(line2.vector, line1.point - line2.point);
-  PointTy F = dot(line1.point - line2.point, line1.point - line2.point);
 
+  // denom is A * C * sin^2 of the angle between the lines: comparing the
+  // sine with epsilon_ keeps the test independent of the vector lengths.
   PointTy denom = A * C - B * B;
-  if (cmp(denom, 0.0)) // Parallel lines
+  if (denom <= epsilon_ * epsilon_ * A * C) // Parallel lines
     return point;
 
   // Nonparallel lines
   PointTy s = (B * E - C * D) / denom;
   PointTy t = (B * D - A * E) / denom;
 
-  PointTy dist = s * (A * s + B * t + 2 * D) + t * (B * s + C * t + 2 * E) + F;
+  // Squared distance between the closest points, from their difference
+  // rather than from the expanded quadratic: line1.point may be far away (the
+  // plane intersection point), and the expansion then cancels.
+  Vector<PointTy> gap = line1.point - line2.point;
+  gap = Vector<PointTy>{gap.x + s * line1.vector.x + t * line2.vector.x,
+                        gap.y + s * line1.vector.y + t * line2.vector.y,
+                        gap.z + s * line1.vector.z + t * line2.vector.z};
+  PointTy dist = dot(gap, gap);
   if (!cmp(dist, 0.0)) // Lines are not on one plane
     return point;
 
@@ -92,9 +100,16 @@ bool intersect_line_with_point(const Triangle<PointTy> t1,
   Point<PointTy> point = t2.get_a();
 
   Vector<PointTy> cross_res = cross(point - line.point, line.vector);
-  if (cmp(cross_res.x, 0.0) && cmp(cross_res.y, 0.0) && cmp(cross_res.z, 0.0))
-    return true;
+  if (!cmp(cross_res.x, 0.0) || !cmp(cross_res.y, 0.0) || !cmp(cross_res.z, 0.0))
+    return false;
+
+  // The point is on the line, check that it is within the segment.
+  auto within = [](PointTy value, PointTy min, PointTy max) {
+    return (value >= min && value <= max) || cmp(value, min) || cmp(value, max);
+  };
 
-  return false;
+  return within(point.x, t1.min_x(), t1.max_x()) &&
+         within(point.y, t1.min_y(), t1.max_y()) &&
+         within(point.z, t1.min_z(), t1.max_z());
 }
 } // namespace triangle
@@ -0,0 +1,254 @@
+#pragma once
+
+#include "box.hpp"
+#include "morton.hpp"
+#include "parallel.hpp"
+#include "stats.hpp"
+#include "trace.hpp"
+#include "triangles.hpp"
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <cstdint>
+#include <optional>
+#include <vector>
+
+namespace triangle {
+
+// Loose octree (Ulrich, "Loose octrees", Game Programming Gems, 2000). A
+// cell of level l has side size / 2^l, and its node holds the triangles
+// whose box centre is in the cell and whose box is at most one side long:
+// such a box lies in the cell widened by half a side on every side, the
+// loose bounds, which are twice the cell. Every triangle goes to the deepest
+// level where it fits, so it is stored exactly once and memory and build
+// time stay O(N) however the triangle sizes are mixed; triangles larger
+// than the root cell stay in the root.
+//
+// Nodes are kept sparse: only nonempty cells exist, sorted by level and by
+// the Morton code of the cell inside a level, so a cell is found by binary
+// search. Boxes of two triangles can overlap only if the cell of the finer
+// one, taken at the level of the coarser one, is that one's cell or its
+// neighbour; so a node is tested against its neighbours at its own level
+// and against the neighbourhoods of its ancestors at the coarser levels.
+template <typename PointTy = double> class LooseOctree {
+public:
+  // Codes of the deepest level take 57 bits, so that the level fits above
+  // them in one radix sort key.
+  static constexpr int max_level = morton_bits - 2;
+
+private:
+  struct Node {
+    int level;
+    uint32_t x, y, z; // Cell at its level
+    uint64_t code;    // Morton code of the cell
+    uint32_t begin, end;
+    Box<PointTy> box; // Of its triangles
+  };
+
+  PointTy origin[3];
+  PointTy size = 1;
+
+  std::vector<Triangle<PointTy>> items; // Grouped by node
+  std::vector<Box<PointTy>> boxes;      // Of items
+  std::vector<Node> nodes;
+  // Nodes of level l are [level_begin[l], level_begin[l + 1]).
+  std::vector<size_t> level_begin;
+
+public:
+  // Boxes are widened by half the margin of brute_force_pairs(), so that
+  // two of them overlap if the triangles are within 16 * epsilon_.
+  LooseOctree(const std::vector<Triangle<PointTy>> &input, size_t threads) {
+    level_begin.assign(max_level + 2, 0);
+    if (input.empty())
+      return;
+
+    std::vector<Box<PointTy>> input_boxes;
+    input_boxes.reserve(input.size());
+    for (const auto &trg : input)
+      input_boxes.emplace_back(trg, 8 * epsilon_);
+
+    // The root cell is the bounding cube of the box centres.
+    auto centre = [](const Box<PointTy> &box, int axis) {
+      return (box.lower[axis] + box.upper[axis]) / 2;
+    };
+    PointTy upper[3];
+    for (int axis = 0; axis < 3; ++axis) {
+      origin[axis] = upper[axis] = centre(input_boxes[0], axis);
+      for (const auto &box : input_boxes) {
+        origin[axis] = std::min(origin[axis], centre(box, axis));
+        upper[axis] = std::max(upper[axis], centre(box, axis));
+      }
+    }
+    size = std::max({upper[0] - origin[0], upper[1] - origin[1],
+                     upper[2] - origin[2]});
+    if (!(size > 0))
+      size = 1;
+
+    // Level above the code of the cell, for every triangle.
+    std::vector<uint64_t> keys(input.size());
+    std::vector<int> levels(input.size());
+    std::vector<std::array<uint32_t, 3>> cells(input.size());
+    for (uint32_t i = 0; i < input.size(); ++i) {
+      const Box<PointTy> &box = input_boxes[i];
+      PointTy extent = std::max({box.upper[0] - box.lower[0],
+                                 box.upper[1] - box.lower[1],
+                                 box.upper[2] - box.lower[2]});
+
+      int level = 0;
+      PointTy side = size;
+      while (level < max_level && extent <= side / 2) {
+        ++level;
+        side /= 2;
+      }
+
+      uint32_t last = (uint32_t{1} << level) - 1;
+      for (int axis = 0; axis < 3; ++axis) {
+        PointTy offset = (centre(box, axis) - origin[axis]) / side;
+        cells[i][axis] = static_cast<uint32_t>(
+            std::clamp<PointTy>(offset, 0, static_cast<PointTy>(last)));
+      }
+      levels[i] = level;
+      keys[i] = uint64_t(level) << 58 |
+                morton_code(cells[i][0], cells[i][1], cells[i][2]);
+    }
+    std::vector<uint32_t> order = radix_sort_order(keys, threads);
+
+    items.reserve(input.size());
+    boxes.reserve(input.size());
+    for (uint32_t k = 0; k < order.size(); ++k) {
+      uint32_t id = order[k];
+      if (k == 0 || keys[id] != keys[order[k - 1]]) {
+        auto [x, y, z] = cells[id];
+        uint64_t code = morton_code(x, y, z);
+        nodes.push_back(Node{levels[id], x, y, z, code, k, k, input_boxes[id]});
+      }
+
+      Node &node = nodes.back();
+      node.box = Box<PointTy>(node.box, input_boxes[id]);
+      ++node.end;
+      items.push_back(input[id]);
+      boxes.push_back(input_boxes[id]);
+    }
+
+    for (int level = 0; level <= max_level + 1; ++level) {
+      level_begin[level] =
+          std::partition_point(nodes.begin(), nodes.end(),
+                               [&](const Node &node) {
+                                 return node.level < level;
+                               }) -
+          nodes.begin();
+    }
+  }
+
+  size_t node_count() const { return nodes.size(); }
+
+  size_t node_size(size_t node) const {
+    return nodes[node].end - nodes[node].begin;
+  }
+
+  std::vector<Triangle<PointTy>> &get_items() { return items; }
+
+  const Box<PointTy> &get_box(size_t item) const { return boxes[item]; }
+
+  // Calls visit(first, second) for every pair of items whose boxes overlap
+  // and of which node holds the first, once over all nodes: pairs within the
+  // node, with nodes of the same level after it, and with coarser nodes.
+  template <typename ItemPairFn>
+  void for_each_overlap(size_t index, ItemPairFn &&visit) const {
+    const Node &node = nodes[index];
+
+    auto visit_nodes = [&](const Node &other) {
+      if (!node.box.overlaps(other.box))
+        return;
+
+      for (uint32_t i = node.begin; i < node.end; ++i) {
+        uint32_t from = &other == &node ? i + 1 : other.begin;
+        for (uint32_t j = from; j < other.end; ++j) {
+          if (boxes[i].overlaps(boxes[j]))
+            visit(i, j);
+        }
+      }
+    };
+
+    for (int level = 0; level <= node.level; ++level) {
+      auto begin = nodes.begin() + level_begin[level];
+      auto end = nodes.begin() + level_begin[level + 1];
+      if (begin == end)
+        continue;
+
+      // Along every axis, the cells around the ancestor whose loose bounds,
+      // [cell - 1/2, cell + 3/2) in units of the side, meet the node's box.
+      int shift = node.level - level;
+      int64_t last = (int64_t{1} << level) - 1;
+      PointTy side = size / static_cast<PointTy>(int64_t{1} << level);
+      int64_t cell[3] = {node.x >> shift, node.y >> shift, node.z >> shift};
+      int64_t from[3], to[3];
+      for (int axis = 0; axis < 3; ++axis) {
+        PointTy lower = (node.box.lower[axis] - origin[axis]) / side;
+        PointTy upper = (node.box.upper[axis] - origin[axis]) / side;
+        from[axis] = std::max<int64_t>(
+            {cell[axis] - 1, 0,
+             static_cast<int64_t>(std::ceil(lower - PointTy(1.5)))});
+        to[axis] = std::min<int64_t>(
+            {cell[axis] + 1, last,
+             static_cast<int64_t>(std::floor(upper + PointTy(0.5)))});
+      }
+
+      for (int64_t x = from[0]; x <= to[0]; ++x) {
+        for (int64_t y = from[1]; y <= to[1]; ++y) {
+          for (int64_t z = from[2]; z <= to[2]; ++z) {
+            uint64_t code = morton_code(x, y, z);
+            // At the node's own level, the pair of nodes is visited from the
+            // one with the smaller code.
+            if (level == node.level && code < node.code)
+              continue;
+
+            auto other = std::lower_bound(
+                begin, end, code,
+                [](const Node &one, uint64_t key) { return one.code < key; });
+            if (other != end && other->code == code)
+              visit_nodes(*other);
+          }
+        }
+      }
+    }
+  }
+};
+
+// Builds a LooseOctree over input and calls on_pair(one, two, worker) for
+// every intersecting pair, once, on threads workers, one node per work
+// item. Pairs within a coplanar group are skipped. K is the
+// triangle-triangle kernel.
+template <Kernel K = Kernel::INTERVALS, typename PointTy = double,
+          typename PairFn>
+void loose_octree_pairs(const std::vector<Triangle<PointTy>> &input,
+                        size_t threads, PairFn &&on_pair) {
+  std::optional<LooseOctree<PointTy>> tree;
+  {
+    stats::Phase phase("build");
+    tree.emplace(input, threads);
+  }
+
+  if (stats::enabled()) {
+    stats::tree.triangles = input.size();
+    for (size_t node = 0; node < tree->node_count(); ++node)
+      stats::tree.add_cell(tree->node_size(node));
+  }
+
+  std::vector<Triangle<PointTy>> &items = tree->get_items();
+
+  stats::Phase phase("narrow");
+  parallel_for(tree->node_count(), threads, [&](size_t node, size_t worker) {
+    trace::Span span("node", tree->node_size(node));
+    tree->for_each_overlap(node, [&](uint32_t first, uint32_t second) {
+      Triangle<PointTy> &one = items[first];
+      Triangle<PointTy> &two = items[second];
+      if (same_plane_group(one, two))
+        return;
+
+      if (check_intersection<K>(one, two))
+        on_pair(one, two, worker);
+    });
+  });
+}
+} // namespace triangle
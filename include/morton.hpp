@@ -0,0 +1,164 @@
+#pragma once
+
+#include "parallel.hpp"
+#include "triangles.hpp"
+#include <algorithm>
+#include <array>
+#include <cstdint>
+#include <limits>
+#include <vector>
+
+namespace triangle {
+
+// 63-bit Morton codes: 21 bits of each coordinate, interleaved as zyx.
+inline constexpr int morton_bits = 21;
+
+// Spreads the low 21 bits of value so that two zero bits follow each one.
+inline uint64_t spread_bits(uint64_t value) {
+  value &= (uint64_t{1} << morton_bits) - 1;
+  value = (value | value << 32) & 0x001f00000000ffffull;
+  value = (value | value << 16) & 0x001f0000ff0000ffull;
+  value = (value | value << 8) & 0x100f00f00f00f00full;
+  value = (value | value << 4) & 0x10c30c30c30c30c3ull;
+  value = (value | value << 2) & 0x1249249249249249ull;
+  return value;
+}
+
+inline uint64_t morton_code(uint32_t x, uint32_t y, uint32_t z) {
+  return spread_bits(x) | spread_bits(y) << 1 | spread_bits(z) << 2;
+}
+
+// [0, size) cut into a few blocks per worker, so that parallel loops over
+// large arrays do not pay an atomic per element.
+struct Blocks {
+  static constexpr size_t min_block = 1 << 14;
+
+  size_t size, count, block_size;
+
+  Blocks(size_t size, size_t threads)
+      : size(size),
+        count(std::clamp<size_t>(size / min_block, 1,
+                                 4 * resolve_threads(threads))),
+        block_size((size + count - 1) / count) {}
+
+  size_t begin(size_t block) const { return std::min(size, block * block_size); }
+  size_t end(size_t block) const {
+    return std::min(size, (block + 1) * block_size);
+  }
+};
+
+// Stable LSD radix sort of the indices [0, codes.size()) by their code, one
+// byte per pass. Workers build histograms of their blocks, a prefix sum over
+// (digit, block) turns them into offsets, and the workers scatter their
+// blocks. Passes where all codes have the same byte are skipped.
+inline std::vector<uint32_t> radix_sort_order(std::vector<uint64_t> codes,
+                                              size_t threads) {
+  constexpr size_t radix = 256;
+
+  size_t size = codes.size();
+  Blocks blocks(size, threads);
+
+  std::vector<uint32_t> order(size);
+  for (size_t i = 0; i < size; ++i)
+    order[i] = i;
+
+  std::vector<uint64_t> codes_out(size);
+  std::vector<uint32_t> order_out(size);
+  std::vector<std::array<size_t, radix>> offsets(blocks.count);
+
+  for (int shift = 0; shift < 64; shift += 8) {
+    parallel_for(blocks.count, threads, [&](size_t block, size_t) {
+      auto &count = offsets[block];
+      count.fill(0);
+      for (size_t i = blocks.begin(block); i < blocks.end(block); ++i)
+        ++count[(codes[i] >> shift) & (radix - 1)];
+    });
+
+    size_t position = 0;
+    bool one_digit = false;
+    for (size_t digit = 0; digit < radix; ++digit) {
+      size_t digit_begin = position;
+      for (auto &count : offsets) {
+        size_t in_block = count[digit];
+        count[digit] = position;
+        position += in_block;
+      }
+      one_digit = one_digit || position - digit_begin == size;
+    }
+    if (one_digit)
+      continue;
+
+    parallel_for(blocks.count, threads, [&](size_t block, size_t) {
+      auto &offset = offsets[block];
+      for (size_t i = blocks.begin(block); i < blocks.end(block); ++i) {
+        size_t target = offset[(codes[i] >> shift) & (radix - 1)]++;
+        codes_out[target] = codes[i];
+        order_out[target] = order[i];
+      }
+    });
+
+    codes.swap(codes_out);
+    order.swap(order_out);
+  }
+
+  return order;
+}
+
+// Morton codes of the centroids of the triangles input[ids[i]], quantized on
+// the bounding box of all these centroids.
+template <typename PointTy = double>
+std::vector<uint64_t> morton_codes(const std::vector<Triangle<PointTy>> &input,
+                                   const std::vector<uint32_t> &ids,
+                                   size_t threads) {
+  // Three times the centroid, which orders the same.
+  auto centroid = [&](uint32_t id) {
+    const Triangle<PointTy> &trg = input[id];
+    Point<PointTy> a = trg.get_a(), b = trg.get_b(), c = trg.get_c();
+    return std::array<PointTy, 3>{a.x + b.x + c.x, a.y + b.y + c.y,
+                                  a.z + b.z + c.z};
+  };
+
+  std::array<PointTy, 3> lower, upper;
+  lower.fill(std::numeric_limits<PointTy>::max());
+  upper.fill(std::numeric_limits<PointTy>::lowest());
+  for (uint32_t id : ids) {
+    auto point = centroid(id);
+    for (int axis = 0; axis < 3; ++axis) {
+      lower[axis] = std::min(lower[axis], point[axis]);
+      upper[axis] = std::max(upper[axis], point[axis]);
+    }
+  }
+
+  constexpr PointTy cells = (uint32_t{1} << morton_bits) - 1;
+  std::array<PointTy, 3> scale;
+  for (int axis = 0; axis < 3; ++axis) {
+    PointTy extent = upper[axis] - lower[axis];
+    scale[axis] = extent > 0 ? cells / extent : 0;
+  }
+
+  std::vector<uint64_t> codes(ids.size());
+  Blocks blocks(ids.size(), threads);
+  parallel_for(blocks.count, threads, [&](size_t block, size_t) {
+    for (size_t i = blocks.begin(block); i < blocks.end(block); ++i) {
+      auto point = centroid(ids[i]);
+      uint32_t cell[3];
+      for (int axis = 0; axis < 3; ++axis)
+        cell[axis] = static_cast<uint32_t>((point[axis] - lower[axis]) *
+                                           scale[axis]);
+      codes[i] = morton_code(cell[0], cell[1], cell[2]);
+    }
+  });
+
+  return codes;
+}
+
+// Positions in ids of the triangles input[ids[i]] in the order of the Morton
+// curve through their centroids: neighbours in this order are mostly
+// neighbours in space.
+template <typename PointTy = double>
+std::vector<uint32_t> morton_order(const std::vector<Triangle<PointTy>> &input,
+                                   const std::vector<uint32_t> &ids,
+                                   size_t threads) {
+  return radix_sort_order(morton_codes(input, ids, threads), threads);
+}
+} // namespace triangle
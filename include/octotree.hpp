@@ -1,20 +1,68 @@
 #pragma once
 
+#include "arena.hpp"
+#include "box.hpp"
+#include "stats.hpp"
+#include "trace.hpp"
 #include "triangles.hpp"
+#include <algorithm>
 #include <deque>
+#include <limits>
 #include <map>
+#include <memory>
+#include <memory_resource>
 #include <vector>
 
 namespace triangle {
 
+template <typename PointTy = double>
+PointTy &coordinate(Vector<PointTy> &vector, size_t axis) {
+  return axis == 0 ? vector.x : (axis == 1 ? vector.y : vector.z);
+}
+
 template <typename PointTy = double> class BoundingBox {
-  std::vector<Triangle<PointTy>> trg_in_cell;
+  using TYPE = typename Triangle<PointTy>::TriangleType;
+
+  // Grouped by type: triangles, then lines, points and invalid ones. Cells
+  // split from this one keep the order, so the grouping is done once.
+  std::pmr::vector<Triangle<PointTy>> trg_in_cell;
 
   Vector<PointTy> min, max;
 
+  // Part of space the cell is responsible for: [lower, upper) on every axis.
+  // Cells of one tree level never overlap in it, unlike in [min, max].
+  Vector<PointTy> lower{-std::numeric_limits<PointTy>::infinity(),
+                        -std::numeric_limits<PointTy>::infinity(),
+                        -std::numeric_limits<PointTy>::infinity()};
+  Vector<PointTy> upper{std::numeric_limits<PointTy>::infinity(),
+                        std::numeric_limits<PointTy>::infinity(),
+                        std::numeric_limits<PointTy>::infinity()};
+
 public:
-  BoundingBox(const std::vector<Triangle<PointTy>> &triangles)
-      : trg_in_cell(triangles) {
+  // The cell keeps triangles, and their memory resource.
+  BoundingBox(std::pmr::vector<Triangle<PointTy>> triangles,
+              const Vector<PointTy> &region_lower,
+              const Vector<PointTy> &region_upper)
+      : BoundingBox(std::move(triangles)) {
+    lower = region_lower;
+    upper = region_upper;
+  }
+
+  BoundingBox(const std::vector<Triangle<PointTy>> &triangles,
+              std::pmr::memory_resource *resource =
+                  std::pmr::get_default_resource())
+      : BoundingBox(std::pmr::vector<Triangle<PointTy>>(
+            triangles.begin(), triangles.end(), resource)) {}
+
+  explicit BoundingBox(std::pmr::vector<Triangle<PointTy>> triangles)
+      : trg_in_cell(std::move(triangles)) {
+    auto by_type = [](const Triangle<PointTy> &one,
+                      const Triangle<PointTy> &two) {
+      return one.get_type() > two.get_type();
+    };
+    if (!std::is_sorted(trg_in_cell.begin(), trg_in_cell.end(), by_type))
+      std::stable_sort(trg_in_cell.begin(), trg_in_cell.end(), by_type);
+
     auto it = trg_in_cell.begin();
     min.x = max.x = it->min_x();
     min.y = max.y = it->min_y();
@@ -36,26 +84,213 @@ public:
 
   PointTy average_z() const { return (max.z + min.z) / 2; }
 
-  std::vector<Triangle<PointTy>> &get_trg_in_cell() { return trg_in_cell; }
+  std::pmr::vector<Triangle<PointTy>> &get_trg_in_cell() { return trg_in_cell; }
 
-  void group_intersections(std::map<size_t, size_t> &result) {
-    for (auto one = trg_in_cell.begin(); one != trg_in_cell.end(); ++one) {
-      auto it = one;
-      it++;
-
-      for (auto two = it; two != trg_in_cell.end(); ++two) {
-        if (check_intersection(*one, *two)) {
-          result[(*one).id] = (*one).id;
-          result[(*two).id] = (*two).id;
+  const Vector<PointTy> &get_lower() const { return lower; }
+
+  const Vector<PointTy> &get_upper() const { return upper; }
+
+private:
+  using Iterator = typename std::pmr::vector<Triangle<PointTy>>::iterator;
+
+  // A pair of triangles straddling a split is put into several cells. The
+  // pair is owned by the only one of them whose region contains the minimum
+  // corner of the overlap of the two bounding boxes (clamped into both boxes
+  // if they do not overlap), which follows the same side of every split as
+  // both triangles do.
+  //
+  // Whether the minimum corner of the bounding box of trg is in the region.
+  // A pair of such triangles is owned by the cell: the corner lies between
+  // their minimum corners and the smaller maximum corner.
+  bool anchors(const Triangle<PointTy> &trg) const {
+    return trg.min_x() >= lower.x && trg.min_x() < upper.x &&
+           trg.min_y() >= lower.y && trg.min_y() < upper.y &&
+           trg.min_z() >= lower.z && trg.min_z() < upper.z;
+  }
+
+  // Tests one against [begin, end). With Owned, the partners whose pair
+  // another cell owns are first dropped in a separate pass and counted as
+  // duplicates (that cell tests them), so that the test loop stays the same
+  // as without ownership. boxes are those of the triangles of the cell, in
+  // the same order.
+  template <TYPE Type1, TYPE Type2, Kernel K, bool Owned, typename PairFn>
+  void test_partners(Iterator one, Iterator begin, Iterator end,
+                     const std::pmr::vector<Box<PointTy>> &boxes,
+                     std::pmr::vector<Iterator> &partners, PairFn &on_pair) const {
+    if constexpr (Owned) {
+      const Box<PointTy> &box = boxes[one - trg_in_cell.begin()];
+      const Box<PointTy> *other = &boxes[begin - trg_in_cell.begin()];
+      const PointTy region_lower[3] = {lower.x, lower.y, lower.z};
+      const PointTy region_upper[3] = {upper.x, upper.y, upper.z};
+
+      // Branch-free compaction: every partner is written, only owned ones
+      // advance the count.
+      size_t count = 0;
+      partners.resize(end - begin);
+      for (size_t k = 0; k < partners.size(); ++k) {
+        bool owned = true;
+        for (int axis = 0; axis < 3; ++axis) {
+          PointTy corner =
+              std::min(std::max(box.lower[axis], other[k].lower[axis]),
+                       std::min(box.upper[axis], other[k].upper[axis]));
+          owned &= (corner >= region_lower[axis]) &
+                   (corner < region_upper[axis]);
         }
+        partners[count] = begin + k;
+        count += owned;
+      }
+      for (size_t k = count; k < partners.size(); ++k)
+        TRIAG_STAT_DUPLICATE_PAIR();
+
+      for (size_t k = 0; k < count; ++k) {
+        Iterator two = partners[k];
+        if (!same_plane_group(*one, *two) &&
+            check_intersection_of<Type1, Type2, PointTy, K>(*one, *two))
+          on_pair(*one, *two);
+      }
+    } else {
+      for (auto two = begin; two != end; ++two) {
+        if (!same_plane_group(*one, *two) &&
+            check_intersection_of<Type1, Type2, PointTy, K>(*one, *two))
+          on_pair(*one, *two);
       }
     }
   }
+
+  // All pairs within [begin, end), every element of type Type. Pairs of a
+  // coplanar group are skipped, coplanar_pairs() handles them.
+  template <TYPE Type, Kernel K, bool Owned, typename PairFn>
+  void pairs_within(Iterator begin, Iterator end,
+                    const std::pmr::vector<Box<PointTy>> &boxes,
+                    std::pmr::vector<Iterator> &partners, PairFn &on_pair) const {
+    for (auto one = begin; one != end; ++one)
+      test_partners<Type, Type, K, Owned>(one, one + 1, end, boxes, partners,
+                                          on_pair);
+  }
+
+  // All pairs of [begin1, end1) of type Type1 and [begin2, end2) of Type2.
+  template <TYPE Type1, TYPE Type2, Kernel K, bool Owned, typename PairFn>
+  void pairs_between(Iterator begin1, Iterator end1, Iterator begin2,
+                     Iterator end2, const std::pmr::vector<Box<PointTy>> &boxes,
+                     std::pmr::vector<Iterator> &partners, PairFn &on_pair) const {
+    for (auto one = begin1; one != end1; ++one)
+      test_partners<Type1, Type2, K, Owned>(one, begin2, end2, boxes, partners,
+                                            on_pair);
+  }
+
+  // Pairs within [begin, end). With Owned, the range is split into the
+  // triangles the cell anchors() and the rest: pairs of the first part are
+  // owned and run the loop without the ownership test.
+  template <TYPE Type, Kernel K, bool Owned, typename PairFn>
+  void pairs_within_group(Iterator begin, Iterator end, Iterator rest,
+                          const std::pmr::vector<Box<PointTy>> &boxes,
+                          std::pmr::vector<Iterator> &partners,
+                          PairFn &on_pair) const {
+    if constexpr (Owned) {
+      pairs_within<Type, K, false>(begin, rest, boxes, partners, on_pair);
+      pairs_between<Type, Type, K, true>(begin, rest, rest, end, boxes,
+                                         partners, on_pair);
+      pairs_within<Type, K, true>(rest, end, boxes, partners, on_pair);
+    } else {
+      pairs_within<Type, K, false>(begin, end, boxes, partners, on_pair);
+    }
+  }
+
+  // Moves the triangles the cell anchors() to the front of [begin, end),
+  // keeping the order, and returns the end of them. As
+  // std::stable_partition(), which takes its buffer from the heap.
+  Iterator partition_anchored(Iterator begin, Iterator end,
+                              std::pmr::memory_resource *scratch) const {
+    std::pmr::vector<Triangle<PointTy>> rest(scratch);
+    Iterator anchored = begin;
+    for (auto it = begin; it != end; ++it) {
+      if (anchors(*it))
+        *anchored++ = *it;
+      else
+        rest.push_back(*it);
+    }
+    std::copy(rest.begin(), rest.end(), anchored);
+    return anchored;
+  }
+
+  // Tests the pairs of the cell, one loop per combination of types, with
+  // the triangle-triangle kernel K. The boxes and partner lists live in
+  // scratch.
+  template <Kernel K, bool Owned, typename PairFn>
+  void for_each_pair(PairFn &on_pair, std::pmr::memory_resource *scratch) {
+    auto type_end = [&](TYPE type) {
+      return std::partition_point(
+          trg_in_cell.begin(), trg_in_cell.end(),
+          [&](const Triangle<PointTy> &trg) { return trg.get_type() >= type; });
+    };
+
+    Iterator type_begin[4] = {trg_in_cell.begin(), type_end(TYPE::TRIANGLE),
+                              type_end(TYPE::LINE), type_end(TYPE::POINT)};
+    Iterator type_rest[3] = {type_begin[1], type_begin[2], type_begin[3]};
+
+    std::pmr::vector<Box<PointTy>> boxes(scratch);
+    if constexpr (Owned) {
+      for (int group = 0; group < 3; ++group) {
+        type_rest[group] =
+            partition_anchored(type_begin[group], type_begin[group + 1],
+                               scratch);
+      }
+
+      boxes.reserve(trg_in_cell.size());
+      for (const auto &trg : trg_in_cell)
+        boxes.emplace_back(trg, 0);
+    }
+
+    std::pmr::vector<Iterator> partners(scratch);
+    auto [triangles, lines, points, end] = type_begin;
+    pairs_within_group<TYPE::TRIANGLE, K, Owned>(triangles, lines, type_rest[0],
+                                                 boxes, partners, on_pair);
+    pairs_between<TYPE::TRIANGLE, TYPE::LINE, K, Owned>(
+        triangles, lines, lines, points, boxes, partners, on_pair);
+    pairs_between<TYPE::TRIANGLE, TYPE::POINT, K, Owned>(
+        triangles, lines, points, end, boxes, partners, on_pair);
+    pairs_within_group<TYPE::LINE, K, Owned>(lines, points, type_rest[1], boxes,
+                                             partners, on_pair);
+    pairs_between<TYPE::LINE, TYPE::POINT, K, Owned>(
+        lines, points, points, end, boxes, partners, on_pair);
+    pairs_within_group<TYPE::POINT, K, Owned>(points, end, type_rest[2], boxes,
+                                              partners, on_pair);
+  }
+
+public:
+  // Calls on_pair(one, two) for every intersecting pair in the cell, also
+  // for pairs that other cells find as well. Temporary lists are allocated
+  // from scratch, an Arena of the worker for one.
+  template <Kernel K = Kernel::INTERVALS, typename PairFn>
+  void for_each_intersection(PairFn &&on_pair,
+                             std::pmr::memory_resource *scratch =
+                                 std::pmr::get_default_resource()) {
+    for_each_pair<K, false>(on_pair, scratch);
+  }
+
+  // Like for_each_intersection(), but only tests the pairs the cell owns, so
+  // every intersecting pair of the tree is tested and reported exactly once.
+  template <Kernel K = Kernel::INTERVALS, typename PairFn>
+  void for_each_owned_intersection(PairFn &&on_pair,
+                                   std::pmr::memory_resource *scratch =
+                                       std::pmr::get_default_resource()) {
+    for_each_pair<K, true>(on_pair, scratch);
+  }
+
+  void group_intersections(std::map<size_t, size_t> &result) {
+    for_each_intersection(
+        [&](const Triangle<PointTy> &one, const Triangle<PointTy> &two) {
+          result[one.id] = one.id;
+          result[two.id] = two.id;
+        });
+  }
 };
 
+// Cells, their triangles and the lists of divide_cell() take their memory
+// from one TreeMemory, released with the tree.
 template <typename PointTy = float> class Octotree {
-  std::vector<Triangle<PointTy>> input;
-  std::deque<BoundingBox<PointTy>> cells;
+  std::unique_ptr<TreeMemory> memory = std::make_unique<TreeMemory>();
+  std::pmr::deque<BoundingBox<PointTy>> cells{memory->resource()};
 
   size_t depth = 0;
   size_t cells_num = 0;
@@ -63,21 +298,23 @@ template <typename PointTy = float> class Octotree {
 
 public:
   Octotree(const std::vector<Triangle<PointTy>> &triangles, size_t max_depth)
-      : input(triangles), depth(max_depth) {
-    cells.push_back(BoundingBox<PointTy>(input));
+      : depth(max_depth) {
+    cells.push_back(BoundingBox<PointTy>(triangles, memory->resource()));
     ++cells_num;
   };
 
-  const std::deque<BoundingBox<PointTy>> &get_cells() { return cells; }
+  std::pmr::deque<BoundingBox<PointTy>> &get_cells() { return cells; }
 
   void divide_cell() {
-    std::vector<Triangle<PointTy>> plus;
-    std::vector<Triangle<PointTy>> minus;
+    std::pmr::vector<Triangle<PointTy>> plus(memory->resource());
+    std::pmr::vector<Triangle<PointTy>> minus(memory->resource());
 
     size_t copy_num_of_cells = cells_num;
 
     for (int i = 0; i < copy_num_of_cells; ++i) {
-      auto front_groups = cells.front();
+      // Children go to the back of the deque, which leaves the reference
+      // valid.
+      auto &front_groups = cells.front();
 
       size_t nod = axis % 3;
       PointTy average = calculate_average(front_groups, nod);
@@ -100,13 +337,28 @@ public:
 
       if (plus.size() + minus.size() <
           front_groups.get_trg_in_cell().size() * 2) {
+        // The split may lie outside the region when triangles stick out
+        // of it; clamped, the children still partition the region.
+        Vector<PointTy> lower = front_groups.get_lower();
+        Vector<PointTy> upper = front_groups.get_upper();
+        PointTy split = std::clamp(average, coordinate(lower, nod),
+                                   coordinate(upper, nod));
+
         if (!plus.empty()) {
-          cells.push_back(BoundingBox<PointTy>(plus));
+          Vector<PointTy> plus_lower = lower;
+          coordinate(plus_lower, nod) = split;
+          cells.push_back(BoundingBox<PointTy>(
+              std::pmr::vector<Triangle<PointTy>>(plus, memory->resource()),
+              plus_lower, front_groups.get_upper()));
           ++cells_num;
         }
 
         if (!minus.empty()) {
-          cells.push_back(BoundingBox<PointTy>(minus));
+          Vector<PointTy> minus_upper = upper;
+          coordinate(minus_upper, nod) = split;
+          cells.push_back(BoundingBox<PointTy>(
+              std::pmr::vector<Triangle<PointTy>>(minus, memory->resource()),
+              front_groups.get_lower(), minus_upper));
           ++cells_num;
         }
 
@@ -135,8 +387,10 @@ public:
 
   void divide_tree() {
     for (int i = 0; i < depth; ++i) {
-      for (int j = 0; j < 3; ++j)
+      for (int j = 0; j < 3; ++j) {
+        trace::Span span("tree_level", i * 3 + j);
         divide_cell();
+      }
     }
   }
 };
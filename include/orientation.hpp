@@ -0,0 +1,279 @@
+#pragma once
+
+#include "point.hpp"
+#include "stats.hpp"
+#include "vector.hpp"
+#include <cmath>
+
+// Triangle-triangle test of Guigue and Devillers ("Fast and robust
+// triangle-triangle overlap test using orientation predicates", 2003). Every
+// decision is the sign of an orient3d or orient2d determinant: no plane
+// equations, intersection lines or intervals are built, and the test never
+// divides. Touching triangles (a zero determinant) count as intersecting.
+// There is no epsilon, so pairs that touch only within epsilon_ may get a
+// different answer than from the interval kernel.
+
+namespace triangle {
+namespace orientation {
+
+template <typename PointTy = double> struct Point2 {
+  PointTy u, v;
+};
+
+// Positive if a, b, c turn counterclockwise.
+template <typename PointTy>
+PointTy orient2d(const Point2<PointTy> &a, const Point2<PointTy> &b,
+                 const Point2<PointTy> &c) {
+  return (a.u - c.u) * (b.v - c.v) - (a.v - c.v) * (b.u - c.u);
+}
+
+// p1 lies in the region of a vertex of the second triangle: p2 of
+// (p2, q2, r2), both triangles counterclockwise.
+template <typename PointTy>
+bool vertex_region_test(const Point2<PointTy> &p1, const Point2<PointTy> &q1,
+                        const Point2<PointTy> &r1, const Point2<PointTy> &p2,
+                        const Point2<PointTy> &q2, const Point2<PointTy> &r2) {
+  if (orient2d(r2, p2, q1) >= 0) {
+    if (orient2d(r2, q2, q1) <= 0) {
+      if (orient2d(p1, p2, q1) > 0)
+        return orient2d(p1, q2, q1) <= 0;
+      return orient2d(p1, p2, r1) >= 0 && orient2d(q1, r1, p2) >= 0;
+    }
+    return orient2d(p1, q2, q1) <= 0 && orient2d(r2, q2, r1) <= 0 &&
+           orient2d(q1, r1, q2) >= 0;
+  }
+
+  if (orient2d(r2, p2, r1) >= 0) {
+    if (orient2d(q1, r1, r2) >= 0)
+      return orient2d(p1, p2, r1) >= 0;
+    return orient2d(q1, r1, q2) >= 0 && orient2d(r2, r1, q2) >= 0;
+  }
+  return false;
+}
+
+// p1 lies in the region of an edge of the second triangle: the one from p2
+// to q2.
+template <typename PointTy>
+bool edge_region_test(const Point2<PointTy> &p1, const Point2<PointTy> &q1,
+                      const Point2<PointTy> &r1, const Point2<PointTy> &p2,
+                      const Point2<PointTy> &q2, const Point2<PointTy> &r2) {
+  (void)q2;
+  if (orient2d(r2, p2, q1) >= 0) {
+    if (orient2d(p1, p2, q1) >= 0)
+      return orient2d(p1, q1, r2) >= 0;
+    return orient2d(q1, r1, p2) >= 0 && orient2d(r1, p1, p2) >= 0;
+  }
+
+  if (orient2d(r2, p2, r1) >= 0 && orient2d(p1, p2, r1) >= 0)
+    return orient2d(p1, r1, r2) >= 0 || orient2d(q1, r1, r2) >= 0;
+  return false;
+}
+
+// Both triangles counterclockwise: locates p1 among the regions cut by the
+// edge lines of the second triangle and runs the test for that region.
+template <typename PointTy>
+bool intersect_ccw_triangles(const Point2<PointTy> &p1,
+                             const Point2<PointTy> &q1,
+                             const Point2<PointTy> &r1,
+                             const Point2<PointTy> &p2,
+                             const Point2<PointTy> &q2,
+                             const Point2<PointTy> &r2) {
+  if (orient2d(p2, q2, p1) >= 0) {
+    if (orient2d(q2, r2, p1) >= 0) {
+      if (orient2d(r2, p2, p1) >= 0)
+        return true; // p1 inside the second triangle
+      return edge_region_test(p1, q1, r1, p2, q2, r2);
+    }
+    if (orient2d(r2, p2, p1) >= 0)
+      return edge_region_test(p1, q1, r1, r2, p2, q2);
+    return vertex_region_test(p1, q1, r1, p2, q2, r2);
+  }
+
+  if (orient2d(q2, r2, p1) >= 0) {
+    if (orient2d(r2, p2, p1) >= 0)
+      return edge_region_test(p1, q1, r1, q2, r2, p2);
+    return vertex_region_test(p1, q1, r1, q2, r2, p2);
+  }
+  return vertex_region_test(p1, q1, r1, r2, p2, q2);
+}
+
+// Test of two triangles in one plane.
+template <typename PointTy>
+bool intersect_triangles_2d(const Point2<PointTy> &p1,
+                            const Point2<PointTy> &q1,
+                            const Point2<PointTy> &r1,
+                            const Point2<PointTy> &p2,
+                            const Point2<PointTy> &q2,
+                            const Point2<PointTy> &r2) {
+  bool ccw1 = orient2d(p1, q1, r1) >= 0;
+  bool ccw2 = orient2d(p2, q2, r2) >= 0;
+
+  if (ccw1)
+    return ccw2 ? intersect_ccw_triangles(p1, q1, r1, p2, q2, r2)
+                : intersect_ccw_triangles(p1, q1, r1, p2, r2, q2);
+  return ccw2 ? intersect_ccw_triangles(p1, r1, q1, p2, q2, r2)
+              : intersect_ccw_triangles(p1, r1, q1, p2, r2, q2);
+}
+
+// Coplanar case: both triangles are projected onto the coordinate plane
+// where the first one has the largest area.
+template <typename PointTy>
+bool intersect_coplanar(const Point<PointTy> &p1, const Point<PointTy> &q1,
+                        const Point<PointTy> &r1, const Point<PointTy> &p2,
+                        const Point<PointTy> &q2, const Point<PointTy> &r2,
+                        const Vector<PointTy> &normal) {
+  TRIAG_STAT_TT_EXIT(TT_COPLANAR);
+
+  PointTy n_x = std::abs(normal.x);
+  PointTy n_y = std::abs(normal.y);
+  PointTy n_z = std::abs(normal.z);
+
+  auto project = [&](const Point<PointTy> &point) {
+    if (n_x > n_z && n_x >= n_y)
+      return Point2<PointTy>{point.y, point.z};
+    if (n_y > n_z && n_y >= n_x)
+      return Point2<PointTy>{point.z, point.x};
+    return Point2<PointTy>{point.x, point.y};
+  };
+
+  return intersect_triangles_2d(project(p1), project(q1), project(r1),
+                                project(p2), project(q2), project(r2));
+}
+
+// p1 is alone on its side of the second plane and p2 alone on its side of
+// the first one: the segments the planes cut from the triangles overlap iff
+// both of these orientations allow it.
+template <typename PointTy>
+bool check_min_max(const Point<PointTy> &p1, const Point<PointTy> &q1,
+                   const Point<PointTy> &r1, const Point<PointTy> &p2,
+                   const Point<PointTy> &q2, const Point<PointTy> &r2) {
+  TRIAG_STAT_TT_EXIT(TT_ORIENTATION);
+
+  if (dot(q2 - q1, cross(p2 - q1, p1 - q1)) > 0)
+    return false;
+  return dot(r2 - p1, cross(p2 - p1, r1 - p1)) <= 0;
+}
+
+// The first triangle has p1 alone on its side of the second plane (or on
+// it); reorders the second triangle the same way using the signs dp2, dq2,
+// dr2 of its vertices against the first plane.
+template <typename PointTy>
+bool intersect_canonical(const Point<PointTy> &p1, const Point<PointTy> &q1,
+                         const Point<PointTy> &r1, const Point<PointTy> &p2,
+                         const Point<PointTy> &q2, const Point<PointTy> &r2,
+                         PointTy dp2, PointTy dq2, PointTy dr2,
+                         const Vector<PointTy> &normal1) {
+  if (dp2 > 0) {
+    if (dq2 > 0)
+      return check_min_max(p1, r1, q1, r2, p2, q2);
+    if (dr2 > 0)
+      return check_min_max(p1, r1, q1, q2, r2, p2);
+    return check_min_max(p1, q1, r1, p2, q2, r2);
+  }
+
+  if (dp2 < 0) {
+    if (dq2 < 0)
+      return check_min_max(p1, q1, r1, r2, p2, q2);
+    if (dr2 < 0)
+      return check_min_max(p1, q1, r1, q2, r2, p2);
+    return check_min_max(p1, r1, q1, p2, q2, r2);
+  }
+
+  if (dq2 < 0) {
+    if (dr2 >= 0)
+      return check_min_max(p1, r1, q1, q2, r2, p2);
+    return check_min_max(p1, q1, r1, p2, q2, r2);
+  }
+
+  if (dq2 > 0) {
+    if (dr2 > 0)
+      return check_min_max(p1, r1, q1, p2, q2, r2);
+    return check_min_max(p1, q1, r1, q2, r2, p2);
+  }
+
+  if (dr2 > 0)
+    return check_min_max(p1, q1, r1, r2, p2, q2);
+  if (dr2 < 0)
+    return check_min_max(p1, r1, q1, r2, p2, q2);
+  return intersect_coplanar(p1, q1, r1, p2, q2, r2, normal1);
+}
+} // namespace orientation
+
+// Guigue-Devillers test of the triangles (p1, q1, r1) and (p2, q2, r2).
+template <typename PointTy = double>
+bool intersect_triangles_by_orientation(
+    const Point<PointTy> &p1, const Point<PointTy> &q1,
+    const Point<PointTy> &r1, const Point<PointTy> &p2,
+    const Point<PointTy> &q2, const Point<PointTy> &r2) {
+  using orientation::intersect_canonical;
+  using orientation::intersect_coplanar;
+
+  // Signs of the vertices of the first triangle against the second plane.
+  Vector<PointTy> normal2 = cross(p2 - r2, q2 - r2);
+  PointTy dp1 = dot(p1 - r2, normal2);
+  PointTy dq1 = dot(q1 - r2, normal2);
+  PointTy dr1 = dot(r1 - r2, normal2);
+  if (dp1 * dq1 > 0 && dp1 * dr1 > 0) {
+    TRIAG_STAT_TT_EXIT(TT_T1_ONE_SIDE);
+    return false;
+  }
+
+  // Signs of the vertices of the second triangle against the first plane.
+  Vector<PointTy> normal1 = cross(q1 - p1, r1 - p1);
+  PointTy dp2 = dot(p2 - r1, normal1);
+  PointTy dq2 = dot(q2 - r1, normal1);
+  PointTy dr2 = dot(r2 - r1, normal1);
+  if (dp2 * dq2 > 0 && dp2 * dr2 > 0) {
+    TRIAG_STAT_TT_EXIT(TT_T2_ONE_SIDE);
+    return false;
+  }
+
+  // Rotates the first triangle so that p1 is alone on its side of the
+  // second plane, flipping the second triangle to keep the orientation.
+  if (dp1 > 0) {
+    if (dq1 > 0)
+      return intersect_canonical(r1, p1, q1, p2, r2, q2, dp2, dr2, dq2,
+                                 normal1);
+    if (dr1 > 0)
+      return intersect_canonical(q1, r1, p1, p2, r2, q2, dp2, dr2, dq2,
+                                 normal1);
+    return intersect_canonical(p1, q1, r1, p2, q2, r2, dp2, dq2, dr2,
+                               normal1);
+  }
+
+  if (dp1 < 0) {
+    if (dq1 < 0)
+      return intersect_canonical(r1, p1, q1, p2, q2, r2, dp2, dq2, dr2,
+                                 normal1);
+    if (dr1 < 0)
+      return intersect_canonical(q1, r1, p1, p2, q2, r2, dp2, dq2, dr2,
+                                 normal1);
+    return intersect_canonical(p1, q1, r1, p2, r2, q2, dp2, dr2, dq2,
+                               normal1);
+  }
+
+  if (dq1 < 0) {
+    if (dr1 >= 0)
+      return intersect_canonical(q1, r1, p1, p2, r2, q2, dp2, dr2, dq2,
+                                 normal1);
+    return intersect_canonical(p1, q1, r1, p2, q2, r2, dp2, dq2, dr2,
+                               normal1);
+  }
+
+  if (dq1 > 0) {
+    if (dr1 > 0)
+      return intersect_canonical(p1, q1, r1, p2, r2, q2, dp2, dr2, dq2,
+                                 normal1);
+    return intersect_canonical(q1, r1, p1, p2, q2, r2, dp2, dq2, dr2,
+                               normal1);
+  }
+
+  if (dr1 > 0)
+    return intersect_canonical(r1, p1, q1, p2, q2, r2, dp2, dq2, dr2,
+                               normal1);
+  if (dr1 < 0)
+    return intersect_canonical(r1, p1, q1, p2, r2, q2, dp2, dr2, dq2,
+                               normal1);
+  return intersect_coplanar(p1, q1, r1, p2, q2, r2, normal1);
+}
+} // namespace triangle
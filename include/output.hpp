@@ -0,0 +1,268 @@
+#pragma once
+
+#include "trace.hpp"
+#include <charconv>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <optional>
+#include <semaphore>
+#include <string_view>
+#include <thread>
+#include <utility>
+#include <vector>
+
+namespace triangle {
+
+// Output with a fixed-size buffer: memory does not grow with the amount of
+// data written, and the number of write calls is output size / capacity.
+//
+// With background set, a full buffer is handed to a writer thread and
+// filling continues in a second buffer of the same size, so formatting
+// overlaps the write calls. Memory is then twice the capacity.
+class BufferedWriter {
+  std::FILE *file;
+  std::vector<char> buffer;
+  size_t used = 0;
+
+  // Background writer: pending is owned by the writer thread between
+  // ready.release() and idle.release().
+  std::vector<char> pending;
+  size_t pending_size = 0;
+  bool stopping = false;
+  std::binary_semaphore ready{0};
+  std::binary_semaphore idle{1};
+  std::thread writer;
+
+  void write_out(const char *data, size_t size) {
+    trace::Span span("flush", size);
+    std::fwrite(data, 1, size, file);
+    std::fflush(file);
+  }
+
+  void run_writer() {
+    while (true) {
+      ready.acquire();
+      if (stopping)
+        return;
+
+      write_out(pending.data(), pending_size);
+      idle.release();
+    }
+  }
+
+  // Blocks until the writer thread has written the previous buffer.
+  void wait_pending() {
+    if (!writer.joinable())
+      return;
+
+    idle.acquire();
+    idle.release();
+  }
+
+public:
+  static constexpr size_t default_capacity = 1 << 20;
+
+  // Enough for any double in shortest form and for fixed notation of values
+  // below 1e15 with up to 16 fractional digits.
+  static constexpr size_t max_double_size = 40;
+
+  explicit BufferedWriter(std::FILE *file,
+                          size_t capacity = default_capacity,
+                          bool background = false)
+      : file(file), buffer(capacity) {
+    if (background) {
+      pending.resize(capacity);
+      writer = std::thread([this] { run_writer(); });
+    }
+  }
+
+  BufferedWriter(const BufferedWriter &) = delete;
+  BufferedWriter &operator=(const BufferedWriter &) = delete;
+
+  ~BufferedWriter() {
+    flush();
+    if (writer.joinable()) {
+      idle.acquire();
+      stopping = true;
+      ready.release();
+      writer.join();
+    }
+  }
+
+  // Makes room for at least bytes more without an intermediate flush.
+  void reserve(size_t bytes) {
+    if (used + bytes > buffer.size())
+      flush();
+  }
+
+  void write_char(char symbol) {
+    reserve(1);
+    buffer[used++] = symbol;
+  }
+
+  void write_uint(uint64_t value) {
+    reserve(20);
+    auto [end, error] =
+        std::to_chars(buffer.data() + used, buffer.data() + buffer.size(), value);
+    used = end - buffer.data();
+  }
+
+  // Shortest representation that reads back to the same value, or fixed
+  // notation with precision digits after the point if precision >= 0.
+  void write_double(double value, int precision = -1) {
+    reserve(max_double_size);
+    char *begin = buffer.data() + used;
+    char *end = buffer.data() + buffer.size();
+    auto result = precision < 0
+                      ? std::to_chars(begin, end, value)
+                      : std::to_chars(begin, end, value,
+                                      std::chars_format::fixed, precision);
+    used = result.ptr - buffer.data();
+  }
+
+  void write_bytes(const void *data, size_t size) {
+    if (size > buffer.size()) {
+      flush();
+      wait_pending();
+      write_out(static_cast<const char *>(data), size);
+      return;
+    }
+
+    reserve(size);
+    std::memcpy(buffer.data() + used, data, size);
+    used += size;
+  }
+
+  void write(std::string_view text) { write_bytes(text.data(), text.size()); }
+
+  // Writes the buffered data out, or hands it to the writer thread.
+  void flush() {
+    if (used == 0)
+      return;
+
+    if (!writer.joinable()) {
+      write_out(buffer.data(), used);
+      used = 0;
+      return;
+    }
+
+    idle.acquire();
+    buffer.swap(pending);
+    pending_size = used;
+    used = 0;
+    ready.release();
+  }
+};
+
+// Ways to print the ids of intersecting triangles.
+enum class IdFormat {
+  LIST,   // One id per line
+  RANGES, // Runs of consecutive ids as "a-b" lines, single ids as "a"
+  BITMAP, // ceil(N / 8) bytes, bit i % 8 of byte i / 8 set for id i
+  COUNT,  // Only the number of intersecting triangles
+};
+
+inline std::optional<IdFormat> parse_id_format(std::string_view name) {
+  if (name == "list")
+    return IdFormat::LIST;
+  if (name == "ranges")
+    return IdFormat::RANGES;
+  if (name == "bitmap")
+    return IdFormat::BITMAP;
+  if (name == "count")
+    return IdFormat::COUNT;
+  return std::nullopt;
+}
+
+// Writes ids i in [0, count) for which is_set(i) holds, in format.
+template <typename IsSet>
+void write_ids(BufferedWriter &writer, size_t count, IdFormat format,
+               IsSet &&is_set) {
+  switch (format) {
+  case IdFormat::LIST:
+    for (size_t i = 0; i < count; ++i) {
+      if (!is_set(i))
+        continue;
+
+      writer.write_uint(i);
+      writer.write_char('\n');
+    }
+    break;
+
+  case IdFormat::RANGES:
+    for (size_t i = 0; i < count; ++i) {
+      if (!is_set(i))
+        continue;
+
+      size_t last = i;
+      while (last + 1 < count && is_set(last + 1))
+        ++last;
+
+      writer.write_uint(i);
+      if (last != i) {
+        writer.write_char('-');
+        writer.write_uint(last);
+      }
+      writer.write_char('\n');
+      i = last;
+    }
+    break;
+
+  case IdFormat::BITMAP:
+    for (size_t i = 0; i < count; i += 8) {
+      unsigned char byte = 0;
+      for (size_t bit = 0; bit < 8 && i + bit < count; ++bit)
+        byte |= static_cast<unsigned char>(is_set(i + bit)) << bit;
+      writer.write_char(static_cast<char>(byte));
+    }
+    break;
+
+  case IdFormat::COUNT: {
+    size_t set = 0;
+    for (size_t i = 0; i < count; ++i)
+      set += is_set(i);
+
+    writer.write_uint(set);
+    writer.write_char('\n');
+    break;
+  }
+  }
+}
+
+// Streams intersecting pairs (i, j), i < j, either as "i j" text lines or as
+// consecutive native-endian uint32 values i, j.
+class PairWriter {
+  static constexpr size_t max_record_size = 2 * 20 + 2;
+
+  BufferedWriter writer;
+  bool binary = false;
+
+public:
+  PairWriter(std::FILE *file, bool binary, bool background = false)
+      : writer(file, BufferedWriter::default_capacity, background),
+        binary(binary) {}
+
+  void write(size_t one, size_t two) {
+    if (one > two)
+      std::swap(one, two);
+
+    // Keep a whole record in one buffer, so a flush never splits a line.
+    writer.reserve(max_record_size);
+
+    if (binary) {
+      uint32_t pair[2] = {static_cast<uint32_t>(one),
+                          static_cast<uint32_t>(two)};
+      writer.write_bytes(pair, sizeof(pair));
+      return;
+    }
+
+    writer.write_uint(one);
+    writer.write_char(' ');
+    writer.write_uint(two);
+    writer.write_char('\n');
+  }
+
+  void flush() { writer.flush(); }
+};
+} // namespace triangle
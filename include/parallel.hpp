@@ -0,0 +1,67 @@
+#pragma once
+
+#include "trace.hpp"
+#include <atomic>
+#include <charconv>
+#include <optional>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+namespace triangle {
+
+// Number of workers to use for a requested thread count, 0 meaning all
+// hardware threads.
+inline size_t resolve_threads(size_t requested) {
+  if (requested != 0)
+    return requested;
+
+  size_t hardware = std::thread::hardware_concurrency();
+  return hardware == 0 ? 1 : hardware;
+}
+
+// Thread count given on the command line: a whole decimal number, 0 for
+// all hardware threads.
+inline std::optional<size_t> parse_threads(std::string_view text) {
+  size_t threads = 0;
+  auto [stop, error] =
+      std::from_chars(text.data(), text.data() + text.size(), threads);
+  if (error != std::errc() || stop != text.data() + text.size())
+    return std::nullopt;
+  return threads;
+}
+
+// Calls body(index, worker) for every index in [0, count). Indices are handed
+// out one by one, so workers stay busy even if the items differ a lot in cost
+// (as octree leaves do). worker is in [0, threads) and can be used to address
+// per-thread state. With one thread everything runs on the calling thread.
+template <typename Body>
+void parallel_for(size_t count, size_t threads, Body &&body) {
+  threads = std::min(resolve_threads(threads), std::max<size_t>(count, 1));
+
+  if (threads == 1) {
+    for (size_t index = 0; index < count; ++index)
+      body(index, size_t{0});
+    return;
+  }
+
+  std::atomic<size_t> next{0};
+  auto work = [&](size_t worker) {
+    trace::Span span("worker", worker);
+    for (size_t index = next.fetch_add(1, std::memory_order_relaxed);
+         index < count;
+         index = next.fetch_add(1, std::memory_order_relaxed)) {
+      body(index, worker);
+    }
+  };
+
+  std::vector<std::thread> workers;
+  for (size_t worker = 1; worker < threads; ++worker)
+    workers.emplace_back(work, worker);
+
+  work(0);
+
+  for (auto &thread : workers)
+    thread.join();
+}
+} // namespace triangle
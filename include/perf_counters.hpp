@@ -0,0 +1,68 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+
+// Hardware performance counters of the whole process (all threads, user
+// space only) read with perf_event_open(2). If the kernel does not allow it
+// (perf_event_paranoid, seccomp, no PMU in a VM) the counters are simply
+// unavailable and every sample is invalid.
+
+namespace triangle::perf {
+
+enum Event {
+  CYCLES,
+  INSTRUCTIONS,
+  CACHE_MISSES,
+  BRANCHES,
+  BRANCH_MISSES,
+  EVENT_NUM
+};
+
+inline const char *event_names[EVENT_NUM] = {
+    "cycles", "instructions", "cache_misses", "branches", "branch_misses"};
+
+struct Sample {
+  bool valid = false;
+  uint64_t values[EVENT_NUM] = {};
+
+  Sample &operator+=(const Sample &other) {
+    valid = valid || other.valid;
+    for (size_t i = 0; i < EVENT_NUM; ++i)
+      values[i] += other.values[i];
+    return *this;
+  }
+
+  Sample operator-(const Sample &other) const {
+    Sample delta;
+    delta.valid = valid && other.valid;
+    for (size_t i = 0; i < EVENT_NUM; ++i)
+      delta.values[i] = values[i] - other.values[i];
+    return delta;
+  }
+
+  double ipc() const {
+    return values[CYCLES] == 0
+               ? 0.0
+               : static_cast<double>(values[INSTRUCTIONS]) / values[CYCLES];
+  }
+
+  double branch_miss_rate() const {
+    return values[BRANCHES] == 0
+               ? 0.0
+               : static_cast<double>(values[BRANCH_MISSES]) / values[BRANCHES];
+  }
+};
+
+// Opens the counters. Threads created afterwards are counted too. Returns
+// false (see error()) if hardware counters are not available.
+bool open();
+
+bool available();
+
+// Why open() failed, empty if it succeeded or was not called.
+const std::string &error();
+
+// Current counter values, scaled up if the kernel had to multiplex them.
+Sample read();
+} // namespace triangle::perf
@@ -0,0 +1,314 @@
+#pragma once
+
+#include "perf_counters.hpp"
+#include "trace.hpp"
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <ctime>
+#include <mutex>
+#include <string>
+#include <vector>
+
+// Run statistics for --stats.
+//
+// Phase timings and tree shape are gathered at run time and only when
+// stats::enabled(). Per-pair work counters sit in the narrow phase, so they
+// are compiled in only with TRIAG_STATS defined: without it the TRIAG_STAT_*
+// macros expand to nothing.
+
+namespace triangle::stats {
+
+// Exits of the triangle-triangle kernels, in test order. The orientation
+// kernel uses the one-side and coplanar exits and ends in TT_ORIENTATION.
+enum TTExit {
+  TT_PARALLEL,         // Parallel, distinct planes
+  TT_COPLANAR,         // Same plane, decided by the 2D test
+  TT_T2_ONE_SIDE,      // T2 entirely on one side of T1's plane
+  TT_T1_ONE_SIDE,      // T1 entirely on one side of T2's plane
+  TT_INVALID_INTERVAL, // No valid interval on the intersection line
+  TT_INTERVALS,        // Decided by the interval overlap
+  TT_ORIENTATION,      // Decided by the orientations of the cut segments
+  TT_EXIT_NUM
+};
+
+inline const char *tt_exit_names[TT_EXIT_NUM] = {
+    "parallel",       "coplanar",         "t2_one_side",
+    "t1_one_side",    "invalid_interval", "intervals",
+    "orientation"};
+
+// Work counters of one thread.
+struct Counters {
+  // Pairs passed to check_intersection, indexed by both TriangleType values.
+  uint64_t pair_types[4][4] = {};
+  uint64_t tt_exits[TT_EXIT_NUM] = {};
+  // Pairs an octree cell skipped untested because another cell owns them.
+  uint64_t duplicate_pairs = 0;
+
+  Counters &operator+=(const Counters &other) {
+    for (size_t i = 0; i < 4; ++i)
+      for (size_t j = 0; j < 4; ++j)
+        pair_types[i][j] += other.pair_types[i][j];
+    for (size_t i = 0; i < TT_EXIT_NUM; ++i)
+      tt_exits[i] += other.tt_exits[i];
+    duplicate_pairs += other.duplicate_pairs;
+    return *this;
+  }
+};
+
+// Thread-local counters are registered while their thread is alive and
+// folded into retired_counters when it exits, so totals survive the worker
+// threads of parallel_for.
+inline std::mutex counters_mutex;
+inline std::vector<Counters *> live_counters;
+inline Counters retired_counters;
+
+struct ThreadCounters {
+  Counters counters;
+
+  ThreadCounters() {
+    std::lock_guard lock(counters_mutex);
+    live_counters.push_back(&counters);
+  }
+
+  ~ThreadCounters() {
+    std::lock_guard lock(counters_mutex);
+    retired_counters += counters;
+    std::erase(live_counters, &counters);
+  }
+};
+
+inline Counters &local() {
+  thread_local ThreadCounters thread_counters;
+  return thread_counters.counters;
+}
+
+inline Counters total_counters() {
+  std::lock_guard lock(counters_mutex);
+  Counters total = retired_counters;
+  for (const Counters *counters : live_counters)
+    total += *counters;
+  return total;
+}
+
+#ifdef TRIAG_STATS
+inline constexpr bool counters_compiled = true;
+#define TRIAG_STAT_PAIR_TYPE(type1, type2)                                     \
+  (++triangle::stats::local().pair_types[type1][type2])
+#define TRIAG_STAT_TT_EXIT(exit)                                               \
+  (++triangle::stats::local().tt_exits[triangle::stats::exit])
+#define TRIAG_STAT_DUPLICATE_PAIR() (++triangle::stats::local().duplicate_pairs)
+#else
+inline constexpr bool counters_compiled = false;
+#define TRIAG_STAT_PAIR_TYPE(type1, type2) ((void)0)
+#define TRIAG_STAT_TT_EXIT(exit) ((void)0)
+#define TRIAG_STAT_DUPLICATE_PAIR() ((void)0)
+#endif
+
+// Requests served by a memory resource, or blocks it took from the heap.
+struct Allocations {
+  uint64_t count = 0;
+  uint64_t bytes = 0;
+
+  Allocations &operator+=(const Allocations &other) {
+    count += other.count;
+    bytes += other.bytes;
+    return *this;
+  }
+};
+
+// Memory of the arenas of arena.hpp, added when each of them is destroyed.
+struct ArenaStats {
+  Allocations served; // Requests of the containers in them
+  Allocations heap;   // Blocks they took from the heap for that
+};
+
+inline ArenaStats arena;
+
+inline void add_arena(const Allocations &served, const Allocations &heap) {
+  std::lock_guard lock(counters_mutex);
+  arena.served += served;
+  arena.heap += heap;
+}
+
+// Shape of the octree after divide_tree(), or of the loose octree.
+struct TreeStats {
+  size_t triangles = 0;
+  size_t cells = 0;
+  size_t triangles_in_cells = 0; // With duplicates of straddling triangles
+  uint64_t candidate_pairs = 0;  // Sum of n * (n - 1) / 2 over cells
+  // histogram[k]: cells with size in [2^k, 2^(k+1)), empty cells in [0].
+  std::vector<size_t> leaf_histogram;
+
+  void add_cell(size_t size) {
+    ++cells;
+    triangles_in_cells += size;
+    if (size > 1)
+      candidate_pairs += static_cast<uint64_t>(size) * (size - 1) / 2;
+
+    size_t bucket = 0;
+    while ((size >> (bucket + 1)) != 0)
+      ++bucket;
+    if (leaf_histogram.size() <= bucket)
+      leaf_histogram.resize(bucket + 1, 0);
+    ++leaf_histogram[bucket];
+  }
+
+  double duplication_factor() const {
+    return triangles == 0 ? 0.0
+                          : static_cast<double>(triangles_in_cells) / triangles;
+  }
+};
+
+// Heap use by phase, filled by the global operator new and delete of
+// src/alloc_hook.cpp in builds with TRIAG_ALLOC_STATS; without it the
+// counters stay zero and alloc_tracked() is false. The hook cannot allocate,
+// so phases get fixed slots, matched by name; slot 0 collects what happens
+// outside every phase. Allocations of all threads go to the phase that is
+// active when they happen.
+struct PhaseAllocations {
+  std::atomic<const char *> name{nullptr};
+  std::atomic<uint64_t> count{0};
+  std::atomic<uint64_t> bytes{0};
+  std::atomic<int64_t> peak{0}; // Live heap bytes, the most while active
+};
+
+inline constexpr size_t alloc_slot_num = 32;
+inline PhaseAllocations alloc_slots[alloc_slot_num];
+inline std::atomic<size_t> alloc_slot{0};  // Of the active phase
+inline std::atomic<int64_t> alloc_live{0}; // Live heap bytes
+inline std::atomic<bool> alloc_tracked_{false};
+
+inline bool alloc_tracked() { return alloc_tracked_.load(); }
+
+inline void raise_peak(PhaseAllocations &slot, int64_t live) {
+  int64_t peak = slot.peak.load(std::memory_order_relaxed);
+  while (live > peak && !slot.peak.compare_exchange_weak(
+                            peak, live, std::memory_order_relaxed))
+    ;
+}
+
+// Called by the hook, size being what the allocator really takes.
+inline void on_allocate(size_t requested, size_t size) {
+  PhaseAllocations &slot =
+      alloc_slots[alloc_slot.load(std::memory_order_relaxed)];
+  slot.count.fetch_add(1, std::memory_order_relaxed);
+  slot.bytes.fetch_add(requested, std::memory_order_relaxed);
+  int64_t live = alloc_live.fetch_add(size, std::memory_order_relaxed) + size;
+  raise_peak(slot, live);
+}
+
+inline void on_free(size_t size) {
+  alloc_live.fetch_sub(size, std::memory_order_relaxed);
+}
+
+// Makes the slot of name active and returns the one that was.
+inline size_t enter_alloc_phase(const char *name) {
+  size_t index = 1;
+  for (; index < alloc_slot_num; ++index) {
+    const char *expected = nullptr;
+    if (alloc_slots[index].name.compare_exchange_strong(expected, name) ||
+        std::strcmp(expected, name) == 0)
+      break;
+  }
+  if (index == alloc_slot_num)
+    index = 0;
+
+  raise_peak(alloc_slots[index], alloc_live.load(std::memory_order_relaxed));
+  return alloc_slot.exchange(index);
+}
+
+inline void leave_alloc_phase(size_t previous) { alloc_slot.store(previous); }
+
+struct PhaseTime {
+  std::string name;
+  double wall_ms = 0;
+  double cpu_ms = 0;
+  perf::Sample hardware; // Valid only if hardware counters are on
+};
+
+inline bool enabled_ = false;
+inline bool hardware_ = false;
+inline std::vector<PhaseTime> phases;
+inline TreeStats tree;
+
+inline void enable() { enabled_ = true; }
+
+inline bool enabled() { return enabled_; }
+
+// Also samples hardware counters around every phase. Returns false if they
+// are not available; timings are collected anyway.
+inline bool enable_hardware() {
+  enable();
+  hardware_ = perf::open();
+  return hardware_;
+}
+
+inline bool hardware() { return hardware_; }
+
+inline double process_cpu_ms() {
+  timespec time{};
+  clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &time);
+  return time.tv_sec * 1e3 + time.tv_nsec / 1e6;
+}
+
+// Adds the wall and CPU (all threads) time of its scope to phase name.
+class Phase {
+  trace::Span span;
+  const char *name;
+  size_t previous_alloc_slot = 0;
+  std::chrono::steady_clock::time_point wall_start;
+  double cpu_start = 0;
+  perf::Sample hardware_start;
+
+public:
+  explicit Phase(const char *name) : span(name), name(name) {
+    if (!enabled())
+      return;
+
+    if (alloc_tracked())
+      previous_alloc_slot = enter_alloc_phase(name);
+
+    if (hardware())
+      hardware_start = perf::read();
+
+    wall_start = std::chrono::steady_clock::now();
+    cpu_start = process_cpu_ms();
+  }
+
+  Phase(const Phase &) = delete;
+  Phase &operator=(const Phase &) = delete;
+
+  ~Phase() {
+    if (!enabled())
+      return;
+
+    if (alloc_tracked())
+      leave_alloc_phase(previous_alloc_slot);
+
+    double wall_ms = std::chrono::duration<double, std::milli>(
+                         std::chrono::steady_clock::now() - wall_start)
+                         .count();
+    double cpu_ms = process_cpu_ms() - cpu_start;
+
+    perf::Sample hardware_delta;
+    if (hardware())
+      hardware_delta = perf::read() - hardware_start;
+
+    for (auto &phase : phases) {
+      if (phase.name == name) {
+        phase.wall_ms += wall_ms;
+        phase.cpu_ms += cpu_ms;
+        phase.hardware += hardware_delta;
+        return;
+      }
+    }
+    phases.push_back({name, wall_ms, cpu_ms, hardware_delta});
+  }
+};
+
+// Prints the collected statistics to stderr, or as JSON into path if it is
+// not empty. Returns false if the file cannot be written.
+bool report(const std::string &path);
+} // namespace triangle::stats
@@ -0,0 +1,147 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+// Span recording for --trace, exported in the Chrome trace-event format
+// (chrome://tracing, ui.perfetto.dev).
+//
+// Every thread appends finished spans to its own fixed-size ring buffer, so
+// recording takes no locks and memory stays bounded; when a buffer is full
+// the oldest spans of that thread are overwritten. When tracing is off a
+// span costs one relaxed load.
+
+namespace triangle::trace {
+
+struct Event {
+  const char *name = nullptr; // Must be a string literal
+  int64_t arg = -1;           // Optional value shown in the viewer, -1: none
+  uint64_t begin_ns = 0;
+  uint64_t end_ns = 0;
+};
+
+class ThreadBuffer {
+  std::vector<Event> events;
+  size_t next = 0;
+  bool wrapped = false;
+
+public:
+  static constexpr size_t capacity = 1 << 16;
+
+  const size_t tid;
+
+  explicit ThreadBuffer(size_t tid) : events(capacity), tid(tid) {}
+
+  void push(const Event &event) {
+    events[next] = event;
+    if (++next == capacity) {
+      next = 0;
+      wrapped = true;
+    }
+  }
+
+  // Recorded events, oldest first.
+  template <typename EventFn> void for_each(EventFn &&on_event) const {
+    if (wrapped) {
+      for (size_t i = next; i < capacity; ++i)
+        on_event(events[i]);
+    }
+    for (size_t i = 0; i < next; ++i)
+      on_event(events[i]);
+  }
+};
+
+inline std::atomic<bool> enabled_{false};
+inline std::mutex buffers_mutex;
+// Buffers outlive their threads, so spans of finished workers can be written.
+inline std::deque<std::unique_ptr<ThreadBuffer>> buffers;
+// Buffers of exited threads, handed to the next new ones.
+inline std::vector<ThreadBuffer *> free_buffers;
+
+inline bool enabled() { return enabled_.load(std::memory_order_relaxed); }
+
+inline void enable() { enabled_.store(true, std::memory_order_relaxed); }
+
+inline uint64_t now_ns() {
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(
+             std::chrono::steady_clock::now().time_since_epoch())
+      .count();
+}
+
+// Buffer of a thread while it runs. parallel_for starts new threads on every
+// call, so a thread that exits gives its buffer back, and the workers of the
+// next call take the free ones with the lowest tids first: the number of
+// buffers stays at the most threads alive at once, and a worker keeps its
+// row in the viewer from call to call.
+class BufferLease {
+  ThreadBuffer *buffer;
+
+public:
+  BufferLease() {
+    std::lock_guard lock(buffers_mutex);
+    if (free_buffers.empty()) {
+      buffers.push_back(std::make_unique<ThreadBuffer>(buffers.size()));
+      buffer = buffers.back().get();
+      return;
+    }
+
+    auto lowest = std::min_element(free_buffers.begin(), free_buffers.end(),
+                                   [](ThreadBuffer *one, ThreadBuffer *two) {
+                                     return one->tid < two->tid;
+                                   });
+    buffer = *lowest;
+    free_buffers.erase(lowest);
+  }
+
+  BufferLease(const BufferLease &) = delete;
+  BufferLease &operator=(const BufferLease &) = delete;
+
+  ~BufferLease() {
+    std::lock_guard lock(buffers_mutex);
+    free_buffers.push_back(buffer);
+  }
+
+  ThreadBuffer &get() const { return *buffer; }
+};
+
+inline ThreadBuffer &local_buffer() {
+  thread_local BufferLease lease;
+  return lease.get();
+}
+
+// Records its scope as one span of the current thread.
+class Span {
+  Event event;
+
+public:
+  explicit Span(const char *name, int64_t arg = -1) {
+    if (!enabled())
+      return;
+
+    event.name = name;
+    event.arg = arg;
+    event.begin_ns = now_ns();
+  }
+
+  Span(const Span &) = delete;
+  Span &operator=(const Span &) = delete;
+
+  ~Span() {
+    if (event.name == nullptr)
+      return;
+
+    event.end_ns = now_ns();
+    local_buffer().push(event);
+  }
+};
+
+// Writes all recorded spans to path. Returns false if it cannot be written.
+bool write(const std::string &path);
+} // namespace triangle::trace
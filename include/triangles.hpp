@@ -2,7 +2,9 @@
 
 #include "interval.hpp"
 #include "line.hpp"
+#include "orientation.hpp"
 #include "plane.hpp"
+#include "stats.hpp"
 
 namespace triangle {
 
@@ -10,6 +12,9 @@ template <typename PointTy = double> class Triangle {
 public:
   enum TriangleType { NONE, POINT, LINE, TRIANGLE };
   size_t id = 0;
+  // Nonzero if the triangle is in a group of coplanar ones, whose pairs
+  // are handled by coplanar_pairs() instead of the broad phase engine.
+  uint32_t plane_group = 0;
 
 private:
   TriangleType type = NONE;
@@ -98,46 +103,134 @@ public:
   PointTy max_z() const { return std::max(a.z, std::max(b.z, c.z)); }
 };
 
-template <typename PointTy = double>
-bool check_intersection(Triangle<PointTy> &t1, Triangle<PointTy> &t2) {
-  using TYPE = typename Triangle<PointTy>::TriangleType;
+// Both triangles are in one group of coplanar ones: coplanar_pairs() has
+// found the pairs of the group, so the broad phase engines skip them.
+template <typename PointTy>
+bool same_plane_group(const Triangle<PointTy> &one,
+                      const Triangle<PointTy> &two) {
+  return one.plane_group != 0 && one.plane_group == two.plane_group;
+}
 
-  TYPE type1 = t1.get_type();
-  TYPE type2 = t2.get_type();
+// Triangle-triangle narrow phase kernels. Only TRIANGLE-TRIANGLE pairs
+// depend on the choice; the other type pairs have one test each.
+enum class Kernel {
+  INTERVALS,   // Plane intersection line and intervals on it (the default)
+  ORIENTATION, // Guigue-Devillers, signs of orient3d/orient2d only
+};
 
-  if (type1 == TYPE::TRIANGLE && type2 == TYPE::TRIANGLE) {
-    return intersect_triangle_with_triangle_in_3D(t1, t2);
-  }
+template <auto Type1, auto Type2, Kernel K, typename PointTy>
+bool intersect_types(Triangle<PointTy> &t1, Triangle<PointTy> &t2) {
+  using TYPE = typename Triangle<PointTy>::TriangleType;
 
-  if (type1 == TYPE::TRIANGLE && type2 == TYPE::LINE) {
+  if constexpr (Type1 == TYPE::TRIANGLE && Type2 == TYPE::TRIANGLE) {
+    if constexpr (K == Kernel::ORIENTATION)
+      return intersect_triangles_by_orientation(t1.get_a(), t1.get_b(),
+                                                t1.get_c(), t2.get_a(),
+                                                t2.get_b(), t2.get_c());
+    else
+      return intersect_triangle_with_triangle_in_3D(t1, t2);
+  } else if constexpr (Type1 == TYPE::TRIANGLE && Type2 == TYPE::LINE) {
     return intersect_triangle_with_line_in_3D(t1, t2);
-  } else if (type1 == TYPE::LINE && type2 == TYPE::TRIANGLE) {
-    return intersect_triangle_with_line_in_3D(t2, t1);
-  }
-
-  if (type1 == TYPE::TRIANGLE && type2 == TYPE::POINT) {
+  } else if constexpr (Type1 == TYPE::TRIANGLE && Type2 == TYPE::POINT) {
     return intersect_triangle_with_point(t1, t2);
-  } else if (type1 == TYPE::POINT && type2 == TYPE::TRIANGLE) {
-    return intersect_triangle_with_point(t2, t1);
-  }
-
-  if (type1 == TYPE::LINE && type2 == TYPE::LINE) {
+  } else if constexpr (Type1 == TYPE::LINE && Type2 == TYPE::LINE) {
     return intersect_line_with_line(t1, t2);
+  } else if constexpr (Type1 == TYPE::LINE && Type2 == TYPE::POINT) {
+    return intersect_line_with_point(t1, t2);
+  } else if constexpr (Type1 == TYPE::POINT && Type2 == TYPE::POINT) {
+    return equal(t1.get_a(), t2.get_a());
+  } else if constexpr (Type1 == TYPE::NONE || Type2 == TYPE::NONE) {
+    return false;
+  } else {
+    // Lower type first: the tests above take the higher one first.
+    return intersect_types<Type2, Type1, K>(t2, t1);
   }
+}
 
-  if (type1 == TYPE::LINE && type2 == TYPE::POINT) {
-    return intersect_line_with_point(t1, t2);
-  } else if (type1 == TYPE::POINT && type2 == TYPE::LINE) {
-    return intersect_line_with_point(t2, t1);
+// Intersection test for triangles whose types are known at compile time:
+// the body is only the test for this pair of types, with no dispatch.
+template <auto Type1, auto Type2, typename PointTy,
+          Kernel K = Kernel::INTERVALS>
+bool check_intersection_of(Triangle<PointTy> &t1, Triangle<PointTy> &t2) {
+  TRIAG_STAT_PAIR_TYPE(Type1, Type2);
+  return intersect_types<Type1, Type2, K>(t1, t2);
+}
+
+template <Kernel K = Kernel::INTERVALS, typename PointTy = double>
+bool check_intersection(Triangle<PointTy> &t1, Triangle<PointTy> &t2) {
+  using TYPE = typename Triangle<PointTy>::TriangleType;
+
+  // Dispatches to the kernel for the pair of types.
+  auto with_second = [&]<auto Type1>() {
+    switch (t2.get_type()) {
+    case TYPE::TRIANGLE:
+      return check_intersection_of<Type1, TYPE::TRIANGLE, PointTy, K>(t1, t2);
+    case TYPE::LINE:
+      return check_intersection_of<Type1, TYPE::LINE, PointTy, K>(t1, t2);
+    case TYPE::POINT:
+      return check_intersection_of<Type1, TYPE::POINT, PointTy, K>(t1, t2);
+    default:
+      return check_intersection_of<Type1, TYPE::NONE, PointTy, K>(t1, t2);
+    }
+  };
+
+  switch (t1.get_type()) {
+  case TYPE::TRIANGLE:
+    return with_second.template operator()<TYPE::TRIANGLE>();
+  case TYPE::LINE:
+    return with_second.template operator()<TYPE::LINE>();
+  case TYPE::POINT:
+    return with_second.template operator()<TYPE::POINT>();
+  default:
+    return with_second.template operator()<TYPE::NONE>();
   }
+}
 
-  if (type1 == TYPE::POINT && type2 == TYPE::POINT) {
-    return equal(t1.get_a(), t2.get_a());
+// Triangles in parallel planes: they intersect only if the planes coincide.
+template <typename PointTy = double>
+bool intersect_parallel_triangles(Triangle<PointTy> &t1, Triangle<PointTy> &t2,
+                                  const Plane<PointTy> &plane1,
+                                  const Plane<PointTy> &plane2) {
+  // Offsets within epsilon_, with the sign of the normals taken into
+  // account: D is rounded differently for different triangles of a plane.
+  if (plane1 == plane2) {
+    TRIAG_STAT_TT_EXIT(TT_COPLANAR);
+    return intersect_triangle_with_triangle_in_2D(t1, t2);
   }
 
+  TRIAG_STAT_TT_EXIT(TT_PARALLEL);
   return false;
 }
 
+// Triangles crossing each other's planes: their intervals on the line of
+// intersection of the planes must overlap.
+template <typename PointTy = double>
+bool intersect_triangles_along_line(Triangle<PointTy> &t1,
+                                    Triangle<PointTy> &t2,
+                                    const Plane<PointTy> &plane1,
+                                    const Plane<PointTy> &plane2) {
+  // Then let's check their intersection. Let's find the line of intersection of
+  // two planes.
+  Line<PointTy> inter_line{get_planes_intersection_vector(plane1, plane2),
+                           get_planes_intersection_point(plane1, plane2)};
+
+  // Let's find the intervals of intersection of triangles with the line of
+  // intersection of planes.
+  Interval interval1 = get_interval_of_triangle_and_line(inter_line, t1);
+  Interval interval2 = get_interval_of_triangle_and_line(inter_line, t2);
+
+  if (!interval1.valid() || !interval2.valid()) {
+    TRIAG_STAT_TT_EXIT(TT_INVALID_INTERVAL);
+    return false;
+  }
+
+  // Let's check if the intervals intersect.
+  TRIAG_STAT_TT_EXIT(TT_INTERVALS);
+  return intersect_intervals(interval1, interval2);
+}
+
+// The common exits come first and stay small enough to be inlined into the
+// cell loops, the rare cases are in the functions above.
 template <typename PointTy = double>
 bool intersect_triangle_with_triangle_in_3D(Triangle<PointTy> &t1,
                                             Triangle<PointTy> &t2) {
@@ -145,14 +238,8 @@ bool intersect_triangle_with_triangle_in_3D(Triangle<PointTy> &t1,
   Plane<PointTy> plane2(t2.get_a(), t2.get_b(), t2.get_c());
 
   // Checking for plane alignment.
-  if (planes_are_parallel(plane1, plane2)) {
-    if ((plane1.get_D() == plane2.get_D()) ||
-        (-plane1.get_D() == plane2.get_D())) {
-      return intersect_triangle_with_triangle_in_2D(t1, t2);
-    }
-
-    return false;
-  }
+  if (planes_are_parallel(plane1, plane2))
+    return intersect_parallel_triangles(t1, t2, plane1, plane2);
 
   // If all the sign distances from the vertices of triangle T2 to triangle T1
   // are of the same sign, then the triangles do not intersect.
@@ -161,6 +248,7 @@ bool intersect_triangle_with_triangle_in_3D(Triangle<PointTy> &t1,
   PointTy signed_dist31 = plane1.substitute(t2.get_c());
   if ((signed_dist11 < 0 && signed_dist21 < 0 && signed_dist31 < 0) ||
       (signed_dist11 > 0 && signed_dist21 > 0 && signed_dist31 > 0)) {
+    TRIAG_STAT_TT_EXIT(TT_T2_ONE_SIDE);
     return false;
   }
 
@@ -171,24 +259,11 @@ bool intersect_triangle_with_triangle_in_3D(Triangle<PointTy> &t1,
   PointTy signed_dist32 = plane2.substitute(t1.get_c());
   if ((signed_dist12 < 0 && signed_dist22 < 0 && signed_dist32 < 0) ||
       (signed_dist12 > 0 && signed_dist22 > 0 && signed_dist32 > 0)) {
+    TRIAG_STAT_TT_EXIT(TT_T1_ONE_SIDE);
     return false;
   }
 
-  // Then let's check their intersection. Let's find the line of intersection of
-  // two planes.
-  Line<PointTy> inter_line{get_planes_intersection_vector(plane1, plane2),
-                           get_planes_intersection_point(plane1, plane2)};
-
-  // Let's find the intervals of intersection of triangles with the line of
-  // intersection of planes.
-  Interval interval1 = get_interval_of_triangle_and_line(inter_line, t1);
-  Interval interval2 = get_interval_of_triangle_and_line(inter_line, t2);
-
-  if (!interval1.valid() || !interval2.valid())
-    return false;
-
-  // Let's check if the intervals intersect.
-  return intersect_intervals(interval1, interval2);
+  return intersect_triangles_along_line(t1, t2, plane1, plane2);
 }
 
 template <typename PointTy = double>
@@ -0,0 +1,63 @@
+#pragma once
+
+#include <atomic>
+#include <vector>
+
+namespace triangle {
+
+// Disjoint-set forest that can be updated from several threads at once
+// without locks. Roots are always linked from the larger index to the
+// smaller one, so parent indices only decrease, no cycles can appear and the
+// root of every set is its smallest element. find() compresses paths by
+// halving with compare-and-swap; a failed swap only means another thread
+// already shortened the path.
+class ConcurrentUnionFind {
+  std::vector<std::atomic<size_t>> parent;
+
+public:
+  explicit ConcurrentUnionFind(size_t size) : parent(size) {
+    for (size_t i = 0; i < size; ++i)
+      parent[i].store(i, std::memory_order_relaxed);
+  }
+
+  size_t size() const { return parent.size(); }
+
+  size_t find(size_t element) {
+    while (true) {
+      size_t up = parent[element].load(std::memory_order_relaxed);
+      if (up == element)
+        return element;
+
+      size_t grand = parent[up].load(std::memory_order_relaxed);
+      if (up != grand) {
+        parent[element].compare_exchange_weak(up, grand,
+                                              std::memory_order_relaxed);
+      }
+
+      element = grand;
+    }
+  }
+
+  void unite(size_t one, size_t two) {
+    while (true) {
+      one = find(one);
+      two = find(two);
+
+      if (one == two)
+        return;
+
+      if (one < two)
+        std::swap(one, two);
+
+      // one is the larger root: hang it under two unless another thread has
+      // linked it somewhere in the meantime.
+      size_t expected = one;
+      if (parent[one].compare_exchange_strong(expected, two,
+                                              std::memory_order_relaxed))
+        return;
+    }
+  }
+
+  bool same(size_t one, size_t two) { return find(one) == find(two); }
+};
+} // namespace triangle
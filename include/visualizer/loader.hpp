@@ -0,0 +1,25 @@
+#pragma once
+
+#include <map>
+#include <vector>
+
+#include "../triangles.hpp"
+
+namespace visualizer {
+// Name of the shared module that contains the OpenGL visualizer. It is
+// loaded with dlopen() only when visualization is requested, so the
+// compute-only binary never links or loads OpenGL, GLEW, GLFW or X11.
+inline constexpr const char *plugin_name = "libtriag_visualizer.so";
+
+// Symbol exported by the plugin (see src/visualizer/plugin.cpp).
+inline constexpr const char *plugin_entry = "triag_run_visualizer";
+
+using PluginEntry = void (*)(std::vector<triangle::Triangle<double>> &,
+                             std::map<size_t, size_t> &);
+
+// Loads the visualizer plugin and runs it. The plugin is searched for in
+// $TRIAG_VISUALIZER_PLUGIN, next to the running executable and finally in the
+// default library search path. Returns false if it could not be loaded.
+bool loadAndRunVisualizer(std::vector<triangle::Triangle<double>> &input,
+                          std::map<size_t, size_t> &intersections);
+} // namespace visualizer
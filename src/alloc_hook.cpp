@@ -0,0 +1,122 @@
+// Global operator new and delete that count every heap allocation into the
+// active --stats phase, see stats::on_allocate(). Linked into triag only
+// with -DTRIAG_ALLOC_STATS=ON: every allocation of the process pays for
+// a few atomic additions.
+
+#include "stats.hpp"
+
+#include <cstdlib>
+#include <malloc.h>
+#include <new>
+
+namespace {
+[[maybe_unused]] const bool installed = [] {
+  triangle::stats::alloc_tracked_.store(true);
+  return true;
+}();
+
+void *allocate(size_t size, size_t alignment) {
+  if (size == 0)
+    size = 1;
+
+  void *pointer = alignment <= __STDCPP_DEFAULT_NEW_ALIGNMENT__
+                      ? std::malloc(size)
+                      : std::aligned_alloc(
+                            alignment, (size + alignment - 1) / alignment *
+                                           alignment);
+  if (pointer != nullptr)
+    triangle::stats::on_allocate(size, malloc_usable_size(pointer));
+  return pointer;
+}
+
+void *allocate_or_throw(size_t size, size_t alignment) {
+  void *pointer = allocate(size, alignment);
+  if (pointer == nullptr)
+    throw std::bad_alloc();
+  return pointer;
+}
+
+void release(void *pointer) {
+  if (pointer == nullptr)
+    return;
+
+  triangle::stats::on_free(malloc_usable_size(pointer));
+  std::free(pointer);
+}
+} // namespace
+
+void *operator new(size_t size) {
+  return allocate_or_throw(size, __STDCPP_DEFAULT_NEW_ALIGNMENT__);
+}
+
+void *operator new[](size_t size) {
+  return allocate_or_throw(size, __STDCPP_DEFAULT_NEW_ALIGNMENT__);
+}
+
+void *operator new(size_t size, std::align_val_t alignment) {
+  return allocate_or_throw(size, static_cast<size_t>(alignment));
+}
+
+void *operator new[](size_t size, std::align_val_t alignment) {
+  return allocate_or_throw(size, static_cast<size_t>(alignment));
+}
+
+void *operator new(size_t size, const std::nothrow_t &) noexcept {
+  return allocate(size, __STDCPP_DEFAULT_NEW_ALIGNMENT__);
+}
+
+void *operator new[](size_t size, const std::nothrow_t &) noexcept {
+  return allocate(size, __STDCPP_DEFAULT_NEW_ALIGNMENT__);
+}
+
+void *operator new(size_t size, std::align_val_t alignment,
+                   const std::nothrow_t &) noexcept {
+  return allocate(size, static_cast<size_t>(alignment));
+}
+
+void *operator new[](size_t size, std::align_val_t alignment,
+                     const std::nothrow_t &) noexcept {
+  return allocate(size, static_cast<size_t>(alignment));
+}
+
+void operator delete(void *pointer) noexcept { release(pointer); }
+
+void operator delete[](void *pointer) noexcept { release(pointer); }
+
+void operator delete(void *pointer, size_t) noexcept { release(pointer); }
+
+void operator delete[](void *pointer, size_t) noexcept { release(pointer); }
+
+void operator delete(void *pointer, std::align_val_t) noexcept {
+  release(pointer);
+}
+
+void operator delete[](void *pointer, std::align_val_t) noexcept {
+  release(pointer);
+}
+
+void operator delete(void *pointer, size_t, std::align_val_t) noexcept {
+  release(pointer);
+}
+
+void operator delete[](void *pointer, size_t, std::align_val_t) noexcept {
+  release(pointer);
+}
+
+void operator delete(void *pointer, const std::nothrow_t &) noexcept {
+  release(pointer);
+}
+
+void operator delete[](void *pointer, const std::nothrow_t &) noexcept {
+  release(pointer);
+}
+
+void operator delete(void *pointer, std::align_val_t,
+                     const std::nothrow_t &) noexcept {
+  release(pointer);
+}
+
+void operator delete[](void *pointer, std::align_val_t,
+                       const std::nothrow_t &) noexcept {
+  release(pointer);
+}
@@ -0,0 +1,181 @@
+#include "generator.hpp"
+#include "intersections.hpp"
+
+#include <algorithm>
+#include <mutex>
+#include <string>
+#include <utility>
+#include <vector>
+
+// triag_difftest: runs every engine with every triangle-triangle kernel on
+// generated datasets and compares the set of intersecting pairs with the
+// brute force oracle (with the default kernel). Prints the first differences
+// and exits with 1 if any run disagrees. The orient kernel has no epsilon, so
+// its runs may disagree on triangles that touch only within epsilon_: such
+// pairs are counted, not failed.
+
+using Pair = std::pair<size_t, size_t>;
+
+void print_help() {
+    std::cout << "Usage: triag_difftest [OPTIONS]\n\n"
+              << "Options:\n"
+              << "  -n, --count N      # Triangles per dataset (default 2000)\n"
+              << "  -s, --seeds S      # Seeds per distribution (default 3)\n"
+              << "  --threads N        # Worker threads, 0 = all cores (default 0)\n"
+              << "  -h, --help         # Show this help message\n";
+}
+
+std::vector<Pair> collect_pairs(const std::vector<triangle::Triangle<double>> &input,
+                                const triangle::SearchOptions &options) {
+  std::vector<Pair> pairs;
+  std::mutex mutex;
+
+  triangle::find_intersecting_pairs(
+      input, options,
+      [&](const triangle::Triangle<double> &one,
+          const triangle::Triangle<double> &two, size_t) {
+        std::lock_guard<std::mutex> lock(mutex);
+        pairs.emplace_back(std::min(one.id, two.id), std::max(one.id, two.id));
+      });
+
+  std::sort(pairs.begin(), pairs.end());
+  return pairs;
+}
+
+// Whether the kernels may disagree on the pair: non-degenerate triangles in
+// planes parallel within epsilon_, or whose intervals on the line of
+// intersection of the planes are apart, but by no more than epsilon_.
+bool touches_within_epsilon(const triangle::Triangle<double> &one,
+                            const triangle::Triangle<double> &two) {
+  using namespace triangle;
+  using TYPE = Triangle<double>::TriangleType;
+
+  if (one.get_type() != TYPE::TRIANGLE || two.get_type() != TYPE::TRIANGLE)
+    return false;
+
+  Plane<double> plane1(one.get_a(), one.get_b(), one.get_c());
+  Plane<double> plane2(two.get_a(), two.get_b(), two.get_c());
+  if (planes_are_parallel(plane1, plane2))
+    return true;
+
+  Line<double> inter_line{get_planes_intersection_vector(plane1, plane2),
+                          get_planes_intersection_point(plane1, plane2)};
+  Interval interval1 = get_interval_of_triangle_and_line(inter_line, one);
+  Interval interval2 = get_interval_of_triangle_and_line(inter_line, two);
+  if (!interval1.valid() || !interval2.valid())
+    return false;
+
+  double gap = interval_gap(interval1, interval2);
+  return gap > 0 && gap <= epsilon_;
+}
+
+// Prints up to limit elements of [first, last) after the title.
+template <typename It>
+void print_some(const char *title, It first, It last, size_t limit = 10) {
+  std::cout << "    " << title << ":";
+  for (size_t printed = 0; first != last && printed < limit; ++first, ++printed)
+    std::cout << " " << first->first << "-" << first->second;
+  if (first != last)
+    std::cout << " ...";
+  std::cout << "\n";
+}
+
+int main(int argc, char **argv) {
+  using namespace triangle;
+
+  size_t count = 2000;
+  uint64_t seeds = 3;
+  size_t threads = 0;
+
+  for (int i = 1; i < argc; ++i) {
+    std::string arg = argv[i];
+    bool has_value = i + 1 < argc;
+
+    if (arg == "-h" || arg == "--help") {
+      print_help();
+      return 0;
+    } else if ((arg == "-n" || arg == "--count") && has_value) {
+      count = static_cast<size_t>(std::stod(argv[++i]));
+    } else if ((arg == "-s" || arg == "--seeds") && has_value) {
+      seeds = std::stoull(argv[++i]);
+    } else if (arg == "--threads" && has_value) {
+      threads = std::stoul(argv[++i]);
+    } else {
+      std::cerr << "Unknown option: " << arg << "\n";
+      print_help();
+      return 1;
+    }
+  }
+
+  // Every engine and kernel except the oracle itself.
+  std::vector<std::pair<Engine, Kernel>> runs;
+  for (Engine engine : all_engines) {
+    for (Kernel kernel : all_kernels) {
+      if (engine != Engine::BRUTE_FORCE || kernel != Kernel::INTERVALS)
+        runs.emplace_back(engine, kernel);
+    }
+  }
+
+  size_t failures = 0;
+
+  for (Distribution distribution : all_distributions) {
+    for (uint64_t seed = 1; seed <= seeds; ++seed) {
+      auto input = generate_triangles<double>(distribution, count, seed);
+
+      SearchOptions oracle_options{Engine::BRUTE_FORCE, threads};
+      std::vector<Pair> expected = collect_pairs(input, oracle_options);
+
+      for (auto [engine, kernel] : runs) {
+        SearchOptions options{engine, threads, kernel};
+        std::vector<Pair> actual = collect_pairs(input, options);
+
+        bool duplicates =
+            std::adjacent_find(actual.begin(), actual.end()) != actual.end();
+        actual.erase(std::unique(actual.begin(), actual.end()), actual.end());
+
+        std::vector<Pair> missing, extra;
+        std::set_difference(expected.begin(), expected.end(), actual.begin(),
+                            actual.end(), std::back_inserter(missing));
+        std::set_difference(actual.begin(), actual.end(), expected.begin(),
+                            expected.end(), std::back_inserter(extra));
+
+        // Missing pairs are the ones the oracle takes within epsilon_; extra
+        // ones can be neither, as the kernel with epsilon_ is the looser.
+        size_t within_epsilon = 0;
+        if (kernel == Kernel::ORIENTATION) {
+          auto touches = [&](const Pair &pair) {
+            return touches_within_epsilon(input[pair.first],
+                                          input[pair.second]);
+          };
+          within_epsilon = std::erase_if(missing, touches);
+        }
+
+        bool ok = missing.empty() && extra.empty() && !duplicates;
+        std::cout << (ok ? "[ OK ] " : "[FAIL] ") << engine_name(engine)
+                  << "/" << kernel_name(kernel) << " "
+                  << distribution_name(distribution) << " n=" << count
+                  << " seed=" << seed << " pairs=" << expected.size();
+        if (within_epsilon)
+          std::cout << " (" << within_epsilon << " within epsilon_)";
+        std::cout << "\n";
+
+        if (ok)
+          continue;
+
+        ++failures;
+        if (duplicates)
+          std::cout << "    pairs reported more than once\n";
+        if (!missing.empty())
+          print_some("missing", missing.begin(), missing.end());
+        if (!extra.empty())
+          print_some("extra", extra.begin(), extra.end());
+      }
+    }
+  }
+
+  if (failures) {
+    std::cout << failures << " mismatching runs\n";
+    return 1;
+  }
+  return 0;
+}
@@ -1,6 +1,26 @@
 #include <gtest/gtest.h>
 
+#include "bvh8.hpp"
+#include "bvtt.hpp"
+#include "compact_bvh.hpp"
+#include "coplanar.hpp"
+#include "degenerate.hpp"
+#include "generator.hpp"
+#include "kdtree.hpp"
+#include "lbvh.hpp"
+#include "loose_octree.hpp"
+#include "morton.hpp"
+#include "octotree.hpp"
+#include "output.hpp"
+#include "parallel.hpp"
 #include "triangles.hpp"
+#include "union_find.hpp"
+
+#include <algorithm>
+#include <mutex>
+#include <numeric>
+#include <random>
+#include <set>
 
 namespace triangle {
 bool cmp(double x, double y) { return fabs(x - y) < epsilon_; }
@@ -356,6 +376,89 @@ TEST(TriangleWithTriangle, Intersection3D_19) {
   ASSERT_TRUE(check_intersection(t1, t2));
 }
 
+TEST(TriangleWithTriangle, Intersection3D_20) {
+  // Planes meet along a line parallel to the y axis, where x is constant.
+  Point t1p1{9.0, 48.0, 8.0};
+  Point t1p2{8.0, 48.0, 8.0};
+  Point t1p3{8.0, 47.0, 8.0};
+  Point t2p1{9.0, 31.0, 5.0};
+  Point t2p2{9.0, 30.0, 9.0};
+  Point t2p3{9.0, 29.0, 8.0};
+
+  Triangle t1{t1p1, t1p2, t1p3};
+  Triangle t2{t2p1, t2p2, t2p3};
+
+  ASSERT_FALSE(check_intersection(t1, t2));
+}
+
+TEST(TriangleWithTriangle, Intersection3D_21) {
+  // Coplanar in x = 9, but the plane offsets differ in the last bit.
+  Point t1p1{9.0, 49.914471389792467, 36.034775578039493};
+  Point t1p2{9.0, 47.676089661794549, 36.450976688212435};
+  Point t1p3{9.0, 48.465720640196267, 32.875535003932612};
+  Point t2p1{9.0, 48.302317766180188, 38.99861273386152};
+  Point t2p2{9.0, 49.574038805168726, 36.733135057872126};
+  Point t2p3{9.0, 48.359672609736194, 35.758982705737743};
+
+  Triangle t1{t1p1, t1p2, t1p3};
+  Triangle t2{t2p1, t2p2, t2p3};
+
+  ASSERT_TRUE(check_intersection(t1, t2));
+  ASSERT_TRUE(check_intersection<Kernel::ORIENTATION>(t1, t2));
+}
+
+TEST(TriangleWithTriangle, Intersection3D_22) {
+  // Small triangles whose planes meet at a shallow angle, far from the
+  // point where the intersection line crosses z = 0.
+  Point t1p1{31.554205146494212, 31.787678216878316, 31.219659921365228};
+  Point t1p2{31.909384295283008, 31.468778379862066, 31.072451287442998};
+  Point t1p3{31.567873396073928, 31.633257465685567, 31.087479441016487};
+  Point t2p1{31.736339217254777, 31.803738037705305, 31.189134770610941};
+  Point t2p2{31.21530288034354, 31.856355475842225, 31.230275477353231};
+  Point t2p3{31.075304818267838, 31.688304347380267, 31.292265921282283};
+
+  Triangle t1{t1p1, t1p2, t1p3};
+  Triangle t2{t2p1, t2p2, t2p3};
+
+  ASSERT_TRUE(check_intersection(t1, t2));
+  ASSERT_TRUE(check_intersection<Kernel::ORIENTATION>(t1, t2));
+}
+
+TEST(TriangleWithTriangle, Intersection3D_23) {
+  // The intersection line passes a few 1e-6 away from a vertex of t2.
+  Point t1p1{43.077056892146452, 43.171249811629835, 42.798422894377794};
+  Point t1p2{42.748044678668315, 43.126198586814773, 42.290619378420082};
+  Point t1p3{42.683339835953582, 42.393198925943352, 42.364985817927561};
+  Point t2p1{42.934069759444995, 42.956601061229584, 42.624667846086574};
+  Point t2p2{42.988077408181034, 43.092706746554256, 42.249994336003894};
+  Point t2p3{42.377666309198489, 42.285611110462817, 42.622915611610061};
+
+  Triangle t1{t1p1, t1p2, t1p3};
+  Triangle t2{t2p1, t2p2, t2p3};
+
+  ASSERT_TRUE(check_intersection(t1, t2));
+  ASSERT_TRUE(check_intersection<Kernel::ORIENTATION>(t1, t2));
+}
+
+TEST(TriangleWithTriangle, Intersection3D_24) {
+  // The triangles miss each other, but their intervals on the intersection
+  // line are apart by 1.2e-6 along z, less than epsilon_: the interval kernel
+  // takes them as touching, the orientation one has no epsilon (octree-worst,
+  // n = 10000, seed 2, pair 6147-9414).
+  Point t1p1{54.265630674951666, 54.233556840757011, 54.247984980547841};
+  Point t1p2{53.607103895943105, 53.563045550470804, 54.016551103696159};
+  Point t1p3{53.470639912556919, 53.382628363156826, 54.315904917686282};
+  Point t2p1{53.408091085847261, 53.73519034075057, 54.23584145233464};
+  Point t2p2{53.645226741342022, 53.837350683181704, 53.845746695570114};
+  Point t2p3{54.306696080947255, 53.392438627419629, 53.58102098349336};
+
+  Triangle t1{t1p1, t1p2, t1p3};
+  Triangle t2{t2p1, t2p2, t2p3};
+
+  ASSERT_TRUE(check_intersection(t1, t2));
+  ASSERT_FALSE(check_intersection<Kernel::ORIENTATION>(t1, t2));
+}
+
 TEST(TriangleWithLine, Intersection3D_1) {
   Point t1p1{0.0, 0.0, 0.0};
   Point t1p2{0.0, 0.0, 2.0};
@@ -702,7 +805,7 @@ TEST(LineWithPoint, Intersection_1) {
   Triangle t1{t1p1, t1p2, t1p3};
   Triangle t2{t2p1, t2p2, t2p3};
 
-  ASSERT_TRUE(check_intersection(t1, t2));
+  ASSERT_FALSE(check_intersection(t1, t2));
 }
 
 TEST(LineWithPoint, Intersection_2) {
@@ -716,7 +819,7 @@ TEST(LineWithPoint, Intersection_2) {
   Triangle t1{t1p1, t1p2, t1p3};
   Triangle t2{t2p1, t2p2, t2p3};
 
-  ASSERT_TRUE(check_intersection(t1, t2));
+  ASSERT_FALSE(check_intersection(t1, t2));
 }
 
 TEST(LineWithPoint, Intersection_3) {
@@ -733,6 +836,20 @@ TEST(LineWithPoint, Intersection_3) {
   ASSERT_FALSE(check_intersection(t1, t2));
 }
 
+TEST(LineWithPoint, Intersection_4) {
+  Point t1p1{1.0, 1.0, 1.0};
+  Point t1p2{2.0, 2.0, 2.0};
+  Point t1p3{3.0, 3.0, 3.0};
+  Point t2p1{2.5, 2.5, 2.5};
+  Point t2p2{2.5, 2.5, 2.5};
+  Point t2p3{2.5, 2.5, 2.5};
+
+  Triangle t1{t1p1, t1p2, t1p3};
+  Triangle t2{t2p1, t2p2, t2p3};
+
+  ASSERT_TRUE(check_intersection(t1, t2));
+}
+
 TEST(PointWithPoint, Intersection_1) {
   Point t1p1{1.0, 1.0, 1.0};
   Point t1p2{1.0, 1.0, 1.0};
@@ -763,6 +880,54 @@ TEST(PointWithPoint, Intersection_2) {
 
 //=================================================
 
+TEST(TestClassOctotree, LeafRegionsAreDisjoint) {
+  // Scene-spanning triangles move the split points outside the regions of
+  // the cells they straddle; the rest sit on the midpoint planes.
+  uint64_t state = 5;
+  auto random = [&] {
+    state = state * 6364136223846793005u + 1442695040888963407u;
+    return state >> 11;
+  };
+  auto unit = [&] { return random() * 0x1.0p-53; };
+  const double size = 64.0;
+  std::vector<Triangle<double>> input;
+  for (size_t i = 0; i < 2000; ++i) {
+    if (i % 10 == 0) {
+      input.emplace_back(Point(0.0, size * unit(), size * unit()),
+                         Point(size, size * unit(), size * unit()),
+                         Point(size * unit(), size * unit(), size));
+    } else {
+      double cells = double(size_t{2} << (random() % 6));
+      auto dyadic = [&] {
+        return std::floor(1 + (cells - 1) * unit()) * size / cells;
+      };
+      Point centre(dyadic(), dyadic(), dyadic());
+      auto near = [&](double value) { return value + unit() - 0.5; };
+      input.emplace_back(Point(near(centre.x), near(centre.y), near(centre.z)),
+                         Point(near(centre.x), near(centre.y), near(centre.z)),
+                         Point(near(centre.x), near(centre.y), near(centre.z)));
+    }
+    input.back().id = i;
+  }
+
+  Octotree<double> octotree(input, 2);
+  octotree.divide_tree();
+
+  auto &cells = octotree.get_cells();
+  for (size_t i = 0; i < cells.size(); ++i) {
+    for (size_t j = i + 1; j < cells.size(); ++j) {
+      const auto &one = cells[i], &two = cells[j];
+      bool overlap = one.get_lower().x < two.get_upper().x &&
+                     two.get_lower().x < one.get_upper().x &&
+                     one.get_lower().y < two.get_upper().y &&
+                     two.get_lower().y < one.get_upper().y &&
+                     one.get_lower().z < two.get_upper().z &&
+                     two.get_lower().z < one.get_upper().z;
+      EXPECT_FALSE(overlap) << "cells " << i << " and " << j;
+    }
+  }
+}
+
 TEST(TestClassPoint, TestValid) {
   Point p1{1.0, 2.0, 3.0};
   Point<float> p2{NAN, 2.0, 3.0};
@@ -857,6 +1022,817 @@ TEST(TestClassPlane, TestOperations) {
   EXPECT_EQ(plane2.substitute(point2), 1);
 }
 
+TEST(TestClassOctotree, OwnedPairsAreUnique) {
+  // A row of overlapping triangles: every split of the tree cuts through
+  // some of them, so pairs are found in several cells.
+  std::vector<Triangle<double>> input;
+  for (size_t i = 0; i < 64; ++i) {
+    double x = 0.5 * i;
+    Triangle<double> trg{Point(x, 0.0, 0.0), Point(x + 2.0, 0.0, 1.0),
+                         Point(x, 1.0, 0.0)};
+    trg.id = i;
+    input.push_back(trg);
+  }
+
+  Octotree<double> octotree(input, 2);
+  octotree.divide_tree();
+
+  auto &cells = octotree.get_cells();
+  std::set<std::pair<size_t, size_t>> all_pairs;
+  size_t owned_pairs = 0;
+
+  // Pairs tested by the kernel, and pairs skipped as owned by another cell.
+  auto tested = [] {
+    stats::Counters counters = stats::total_counters();
+    return counters.pair_types[0][0] + counters.pair_types[1][1] +
+           counters.pair_types[2][2] + counters.pair_types[3][3];
+  };
+  auto skipped = [] { return stats::total_counters().duplicate_pairs; };
+
+  uint64_t tested_all = 0, tested_owned = 0, skipped_owned = 0;
+  for (auto &cell : cells) {
+    uint64_t before = tested();
+    cell.for_each_intersection(
+        [&](const Triangle<double> &one, const Triangle<double> &two) {
+          all_pairs.emplace(std::min(one.id, two.id), std::max(one.id, two.id));
+        });
+    tested_all += tested() - before;
+
+    before = tested();
+    uint64_t skipped_before = skipped();
+    cell.for_each_owned_intersection(
+        [&](const Triangle<double> &, const Triangle<double> &) {
+          ++owned_pairs;
+        });
+    tested_owned += tested() - before;
+    skipped_owned += skipped() - skipped_before;
+  }
+
+  EXPECT_GT(cells.size(), 1);
+  EXPECT_EQ(owned_pairs, all_pairs.size());
+
+  // Ownership is checked before the test: every pair is tested once.
+  if (stats::counters_compiled) {
+    EXPECT_GT(skipped_owned, 0u);
+    EXPECT_EQ(tested_owned + skipped_owned, tested_all);
+  }
+}
+
+// Interleaved triangles, vertical segments through them and points on the
+// segments (every other one twice), so that every combination of types
+// intersects.
+std::vector<Triangle<double>> mixed_type_input() {
+  std::vector<Triangle<double>> input;
+  for (size_t i = 0; i < 32; ++i) {
+    double x = 0.5 * i;
+    input.emplace_back(Point(x, 0.0, 0.0), Point(x + 2.0, 0.0, 1.0),
+                       Point(x, 1.0, 0.0));
+    input.emplace_back(Point(x + 0.2, 0.2, -1.0), Point(x + 0.2, 0.2, 1.0),
+                       Point(x + 0.2, 0.2, 0.0));
+    for (size_t copy = 0; copy <= i % 2; ++copy) {
+      Point point(x + 0.2, 0.2, 0.5);
+      input.emplace_back(point, point, point);
+    }
+  }
+
+  // Lines across all of the above in the a a b form of collapsed CAD
+  // slivers, the second crossing the first.
+  Point along_from(-1.0, 0.5, 0.25), along_to(18.0, 0.5, 0.25);
+  input.emplace_back(along_from, along_from, along_to);
+  Point across_from(-1.0, -1.0, 0.25), across_to(18.0, 2.0, 0.25);
+  input.emplace_back(across_from, across_from, across_to);
+
+  for (size_t i = 0; i < input.size(); ++i)
+    input[i].id = i;
+  return input;
+}
+
+// Intersecting pairs (i < j) of input, testing every pair.
+std::set<std::pair<size_t, size_t>>
+all_intersecting_pairs(const std::vector<Triangle<double>> &input) {
+  std::set<std::pair<size_t, size_t>> pairs;
+  for (size_t i = 0; i < input.size(); ++i) {
+    for (size_t j = i + 1; j < input.size(); ++j) {
+      Triangle<double> one = input[i], two = input[j];
+      if (check_intersection(one, two))
+        pairs.emplace(i, j);
+    }
+  }
+  return pairs;
+}
+
+TEST(TestClassOctotree, TypeGroupsMatchAllPairs) {
+  // The cell reorders triangles by type and must still test every pair.
+  std::vector<Triangle<double>> input = mixed_type_input();
+  std::set<std::pair<size_t, size_t>> expected = all_intersecting_pairs(input);
+
+  BoundingBox<double> cell(input);
+  std::set<std::pair<size_t, size_t>> found;
+  cell.for_each_intersection(
+      [&](const Triangle<double> &one, const Triangle<double> &two) {
+        found.emplace(std::min(one.id, two.id), std::max(one.id, two.id));
+      });
+
+  EXPECT_FALSE(expected.empty());
+  EXPECT_EQ(found, expected);
+}
+
+TEST(TestClassDegenerate, FastPathMatchesAllPairs) {
+  using TYPE = Triangle<double>::TriangleType;
+
+  std::vector<Triangle<double>> input = mixed_type_input();
+  std::vector<uint32_t> points, lines, solids;
+  for (uint32_t i = 0; i < input.size(); ++i) {
+    TYPE type = input[i].get_type();
+    (type == TYPE::POINT ? points : type == TYPE::LINE ? lines : solids)
+        .push_back(i);
+  }
+
+  // Every pair with a POINT or LINE operand, and only those.
+  std::set<std::pair<size_t, size_t>> expected;
+  for (auto pair : all_intersecting_pairs(input)) {
+    if (input[pair.first].get_type() != TYPE::TRIANGLE ||
+        input[pair.second].get_type() != TYPE::TRIANGLE)
+      expected.insert(pair);
+  }
+
+  std::mutex mutex;
+  std::set<std::pair<size_t, size_t>> found;
+  size_t reported = 0;
+  degenerate_pairs(input, points, lines, solids, 4,
+                   [&](const Triangle<double> &one,
+                       const Triangle<double> &two, size_t) {
+                     std::lock_guard<std::mutex> lock(mutex);
+                     found.emplace(std::min(one.id, two.id),
+                                   std::max(one.id, two.id));
+                     ++reported;
+                   });
+
+  EXPECT_FALSE(points.empty() || lines.empty());
+  EXPECT_EQ(found, expected);
+  EXPECT_EQ(reported, found.size());
+}
+
+TEST(TestClassCoplanar, PlaneGroupsMatchAllPairs) {
+  // A triangulated 4x4 grid in z = 1 (pairs touching at edges and vertices),
+  // shifted copies of some of its triangles and a vertical triangle through
+  // the grid, which is in no group.
+  std::vector<Triangle<double>> input;
+  for (double i = 0; i < 4; ++i) {
+    for (double j = 0; j < 4; ++j) {
+      Point p00(i, j, 1.0), p10(i + 1.0, j, 1.0), p01(i, j + 1.0, 1.0),
+          p11(i + 1.0, j + 1.0, 1.0);
+      input.emplace_back(p00, p10, p11);
+      input.emplace_back(p00, p11, p01);
+      if (static_cast<int>(i + j) % 3 == 0)
+        input.emplace_back(Point(i + 0.3, j + 0.2, 1.0),
+                           Point(i + 1.4, j + 0.5, 1.0),
+                           Point(i + 0.6, j + 1.7, 1.0));
+    }
+  }
+  input.emplace_back(Point(0.5, 0.5, 0.0), Point(3.5, 3.5, 0.0),
+                     Point(2.0, 2.0, 2.0));
+  for (size_t i = 0; i < input.size(); ++i)
+    input[i].id = i;
+
+  std::set<std::pair<size_t, size_t>> expected;
+  for (auto pair : all_intersecting_pairs(input)) {
+    if (pair.second != input.size() - 1)
+      expected.insert(pair);
+  }
+
+  std::mutex mutex;
+  std::set<std::pair<size_t, size_t>> found;
+  coplanar_pairs(input, 4,
+                 [&](const Triangle<double> &one, const Triangle<double> &two,
+                     size_t) {
+                   std::lock_guard<std::mutex> lock(mutex);
+                   found.emplace(std::min(one.id, two.id),
+                                 std::max(one.id, two.id));
+                 });
+
+  EXPECT_EQ(found, expected);
+  EXPECT_NE(input.front().plane_group, 0);
+  EXPECT_EQ(input.back().plane_group, 0);
+}
+
+TEST(TestClassCoplanar, TiltedPlaneIsOneGroup) {
+  // Overlapping triangles in a plane that is not axis-aligned: their
+  // vertices are rounded, so the offsets of their planes differ in the last
+  // bits.
+  const double origin[3] = {3.1, 7.7, 1.3};
+  const double u[3] = {0.6, 0.8, 0.0}, w[3] = {-0.48, 0.36, 0.8};
+  auto at = [&](double s, double t) {
+    return Point(origin[0] + s * u[0] + t * w[0],
+                 origin[1] + s * u[1] + t * w[1],
+                 origin[2] + s * u[2] + t * w[2]);
+  };
+
+  std::vector<Triangle<double>> input;
+  for (double s = 0; s < 6; ++s) {
+    for (double t = 0; t < 6; ++t)
+      input.emplace_back(at(s * 0.7, t * 0.7), at(s * 0.7 + 1.3, t * 0.7),
+                         at(s * 0.7 + 0.1, t * 0.7 + 1.1));
+  }
+  for (size_t i = 0; i < input.size(); ++i)
+    input[i].id = i;
+
+  double lowest = PlaneKey(input.front()).d, highest = lowest;
+  for (const auto &trg : input) {
+    lowest = std::min(lowest, PlaneKey(trg).d);
+    highest = std::max(highest, PlaneKey(trg).d);
+  }
+  EXPECT_LT(lowest, highest);
+
+  std::mutex mutex;
+  std::set<std::pair<size_t, size_t>> found;
+  coplanar_pairs(input, 4,
+                 [&](const Triangle<double> &one, const Triangle<double> &two,
+                     size_t) {
+                   std::lock_guard<std::mutex> lock(mutex);
+                   found.emplace(std::min(one.id, two.id),
+                                 std::max(one.id, two.id));
+                 });
+
+  EXPECT_EQ(found, all_intersecting_pairs(input));
+  EXPECT_NE(input.front().plane_group, 0);
+  for (const auto &trg : input)
+    EXPECT_EQ(trg.plane_group, input.front().plane_group);
+}
+
+TEST(TestClassOrientation, MatchesIntervalKernel) {
+  using TYPE = Triangle<double>::TriangleType;
+
+  // Dense distributions: crossing, touching and coplanar pairs.
+  for (Distribution distribution :
+       {Distribution::CLUSTERS, Distribution::COPLANAR, Distribution::GRID,
+        Distribution::OCTREE_WORST}) {
+    std::vector<Triangle<double>> input =
+        generate_triangles<double>(distribution, 400, 7);
+
+    size_t hits = 0;
+    for (size_t i = 0; i < input.size(); ++i) {
+      for (size_t j = i + 1; j < input.size(); ++j) {
+        auto &one = input[i], &two = input[j];
+        if (one.get_type() != TYPE::TRIANGLE ||
+            two.get_type() != TYPE::TRIANGLE)
+          continue;
+
+        bool expected =
+            check_intersection_of<TYPE::TRIANGLE, TYPE::TRIANGLE, double>(
+                one, two);
+        bool actual = check_intersection_of<TYPE::TRIANGLE, TYPE::TRIANGLE,
+                                            double, Kernel::ORIENTATION>(one,
+                                                                         two);
+        hits += expected;
+        EXPECT_EQ(actual, expected)
+            << distribution_name(distribution) << " " << i << "-" << j;
+      }
+    }
+    EXPECT_GT(hits, 0u) << distribution_name(distribution);
+  }
+}
+
+TEST(TestClassOrientation, TouchingTriangles) {
+  Triangle<double> base{Point(0.0, 0.0, 0.0), Point(2.0, 0.0, 0.0),
+                        Point(0.0, 2.0, 0.0)};
+
+  // Shared vertex, shared edge, vertex on the face, and a parallel copy.
+  Triangle<double> vertex{Point(0.0, 0.0, 0.0), Point(-1.0, 0.0, 1.0),
+                          Point(0.0, -1.0, 1.0)};
+  Triangle<double> edge{Point(0.0, 0.0, 0.0), Point(2.0, 0.0, 0.0),
+                        Point(1.0, 0.0, 3.0)};
+  Triangle<double> face{Point(0.5, 0.5, 0.0), Point(1.0, 1.0, 2.0),
+                        Point(0.0, 1.0, 2.0)};
+  Triangle<double> parallel{Point(0.0, 0.0, 1e-3), Point(2.0, 0.0, 1e-3),
+                            Point(0.0, 2.0, 1e-3)};
+
+  // Coplanar: overlapping, touching at a vertex and apart.
+  Triangle<double> overlap{Point(1.0, 1.0, 0.0), Point(-1.0, 0.5, 0.0),
+                           Point(0.5, -1.0, 0.0)};
+  Triangle<double> corner{Point(2.0, 0.0, 0.0), Point(3.0, 0.0, 0.0),
+                          Point(3.0, 1.0, 0.0)};
+  Triangle<double> apart{Point(1.5, 1.5, 0.0), Point(3.0, 1.5, 0.0),
+                         Point(1.5, 3.0, 0.0)};
+
+  EXPECT_TRUE(check_intersection<Kernel::ORIENTATION>(base, vertex));
+  EXPECT_TRUE(check_intersection<Kernel::ORIENTATION>(base, edge));
+  EXPECT_TRUE(check_intersection<Kernel::ORIENTATION>(base, face));
+  EXPECT_FALSE(check_intersection<Kernel::ORIENTATION>(base, parallel));
+  EXPECT_TRUE(check_intersection<Kernel::ORIENTATION>(base, overlap));
+  EXPECT_TRUE(check_intersection<Kernel::ORIENTATION>(base, corner));
+  EXPECT_FALSE(check_intersection<Kernel::ORIENTATION>(base, apart));
+}
+
+TEST(TestClassMorton, Codes) {
+  constexpr uint32_t max = (uint32_t{1} << morton_bits) - 1;
+
+  EXPECT_EQ(morton_code(1, 0, 0), 1u);
+  EXPECT_EQ(morton_code(0, 1, 0), 2u);
+  EXPECT_EQ(morton_code(0, 0, 1), 4u);
+  EXPECT_EQ(morton_code(3, 0, 0), 9u);
+  EXPECT_EQ(morton_code(max, max, max), (uint64_t{1} << 63) - 1);
+}
+
+TEST(TestClassMorton, RadixSortMatchesStableSort) {
+  // Several blocks per worker, and codes with equal high bytes, so that
+  // both the skipped passes and the stability across blocks are covered.
+  std::mt19937_64 random(7);
+  std::vector<uint64_t> codes(100000);
+  for (auto &code : codes)
+    code = random() >> 40;
+
+  std::vector<uint32_t> expected(codes.size());
+  std::iota(expected.begin(), expected.end(), 0);
+  std::stable_sort(expected.begin(), expected.end(),
+                   [&](uint32_t one, uint32_t two) {
+                     return codes[one] < codes[two];
+                   });
+
+  EXPECT_EQ(radix_sort_order(codes, 4), expected);
+  EXPECT_EQ(radix_sort_order(codes, 1), expected);
+}
+
+TEST(TestClassMorton, OrderFollowsCentroids) {
+  // Small triangles along a diagonal, listed backwards: the curve visits
+  // them from the lower corner.
+  std::vector<Triangle<double>> input;
+  for (double i = 9; i >= 0; --i)
+    input.emplace_back(Point(i, i, i), Point(i + 0.5, i, i),
+                       Point(i, i + 0.5, i));
+
+  std::vector<uint32_t> ids(input.size());
+  std::iota(ids.begin(), ids.end(), 0);
+  std::vector<uint32_t> order = morton_order(input, ids, 2);
+
+  std::vector<uint32_t> expected(ids.rbegin(), ids.rend());
+  EXPECT_EQ(order, expected);
+}
+
+// Pairs of ids whose leaf boxes overlap, found through the tree and by
+// testing all pairs of leaves.
+static std::pair<std::multiset<std::pair<size_t, size_t>>,
+                 std::multiset<std::pair<size_t, size_t>>>
+lbvh_overlaps(const std::vector<Triangle<double>> &input) {
+  LinearBVH<double> bvh(input, 4);
+  auto &leaves = bvh.get_leaves();
+
+  std::multiset<std::pair<size_t, size_t>> found, expected;
+  for (uint32_t leaf = 0; leaf < leaves.size(); ++leaf) {
+    bvh.for_each_overlap(leaf, [&](uint32_t other) {
+      found.emplace(std::min(leaves[leaf].id, leaves[other].id),
+                    std::max(leaves[leaf].id, leaves[other].id));
+    });
+    for (uint32_t other = leaf + 1; other < leaves.size(); ++other) {
+      if (bvh.get_leaf_box(leaf).overlaps(bvh.get_leaf_box(other)))
+        expected.emplace(std::min(leaves[leaf].id, leaves[other].id),
+                         std::max(leaves[leaf].id, leaves[other].id));
+    }
+  }
+  return {found, expected};
+}
+
+TEST(TestClassLBVH, OverlapsMatchAllPairs) {
+  for (Distribution distribution :
+       {Distribution::UNIFORM, Distribution::CLUSTERS, Distribution::GRID}) {
+    std::vector<Triangle<double>> input =
+        generate_triangles<double>(distribution, 1000, 3);
+    auto [found, expected] = lbvh_overlaps(input);
+
+    EXPECT_EQ(found, expected) << distribution_name(distribution);
+    EXPECT_FALSE(found.empty()) << distribution_name(distribution);
+  }
+}
+
+TEST(TestClassLBVH, EqualCodes) {
+  // Copies of one triangle share their Morton code; the tree tells them
+  // apart by position and must still pair every two of them.
+  std::vector<Triangle<double>> input;
+  for (int i = 0; i < 40; ++i)
+    input.emplace_back(Point(0.0, 0.0, 0.0), Point(1.0, 0.0, 0.0),
+                       Point(0.0, 1.0, 0.0));
+  input.emplace_back(Point(5.0, 5.0, 5.0), Point(6.0, 5.0, 5.0),
+                     Point(5.0, 6.0, 5.0));
+  for (size_t i = 0; i < input.size(); ++i)
+    input[i].id = i;
+
+  auto [found, expected] = lbvh_overlaps(input);
+  EXPECT_EQ(found, expected);
+  EXPECT_EQ(found.size(), 40u * 39 / 2);
+
+  std::vector<Triangle<double>> single(input.begin(), input.begin() + 1);
+  EXPECT_TRUE(lbvh_overlaps(single).first.empty());
+}
+
+TEST(TestClassBVTT, MatchesLeafQueries) {
+  for (Distribution distribution :
+       {Distribution::UNIFORM, Distribution::CLUSTERS, Distribution::GRID,
+        Distribution::OCTREE_WORST}) {
+    std::vector<Triangle<double>> input =
+        generate_triangles<double>(distribution, 1000, 5);
+    LinearBVH<double> bvh(input, 1);
+
+    std::multiset<std::pair<uint32_t, uint32_t>> expected;
+    for (uint32_t leaf = 0; leaf < bvh.size(); ++leaf) {
+      bvh.for_each_overlap(
+          leaf, [&](uint32_t other) { expected.emplace(leaf, other); });
+    }
+
+    std::mutex mutex;
+    std::multiset<std::pair<uint32_t, uint32_t>> found;
+    for_each_overlapping_leaves(bvh, 4,
+                                [&](uint32_t one, uint32_t two, size_t) {
+                                  std::lock_guard<std::mutex> lock(mutex);
+                                  found.emplace(one, two);
+                                });
+
+    EXPECT_EQ(found, expected) << distribution_name(distribution);
+    EXPECT_FALSE(found.empty()) << distribution_name(distribution);
+  }
+}
+
+TEST(TestClassLooseOctree, OverlapsMatchAllPairs) {
+  for (Distribution distribution :
+       {Distribution::UNIFORM, Distribution::CLUSTERS,
+        Distribution::OCTREE_WORST}) {
+    std::vector<Triangle<double>> input =
+        generate_triangles<double>(distribution, 1000, 7);
+    // Triangles of every size, down to a point, to spread them over levels.
+    for (int i = 0; i < 20; ++i) {
+      double size = 100.0 / (1 << i);
+      input.emplace_back(Point(0.0, 0.0, 0.0), Point(size, 0.0, 0.0),
+                         Point(0.0, size, size));
+    }
+    for (size_t i = 0; i < input.size(); ++i)
+      input[i].id = i;
+
+    LooseOctree<double> tree(input, 1);
+    std::vector<Triangle<double>> &items = tree.get_items();
+    ASSERT_EQ(items.size(), input.size());
+
+    std::multiset<std::pair<size_t, size_t>> found, expected;
+    for (size_t node = 0; node < tree.node_count(); ++node) {
+      tree.for_each_overlap(node, [&](uint32_t one, uint32_t two) {
+        found.emplace(std::min(items[one].id, items[two].id),
+                      std::max(items[one].id, items[two].id));
+      });
+    }
+    for (size_t one = 0; one < items.size(); ++one) {
+      for (size_t two = one + 1; two < items.size(); ++two) {
+        if (tree.get_box(one).overlaps(tree.get_box(two)))
+          expected.emplace(std::min(items[one].id, items[two].id),
+                           std::max(items[one].id, items[two].id));
+      }
+    }
+
+    EXPECT_EQ(found, expected) << distribution_name(distribution);
+    EXPECT_GT(tree.node_count(), 1u) << distribution_name(distribution);
+  }
+}
+
+TEST(TestClassKdTree, OverlapsMatchAllPairs) {
+  // A thin plate: small triangles in a 100 x 100 x 0.01 slab, which the
+  // planes must cut across and never along.
+  std::mt19937 random(11);
+  std::uniform_real_distribution<double> along(0.0, 100.0), across(0.0, 0.01);
+  std::vector<Triangle<double>> plate;
+  for (int i = 0; i < 1000; ++i) {
+    double x = along(random), y = along(random), z = across(random);
+    plate.emplace_back(Point(x, y, z), Point(x + 1.5, y, z),
+                       Point(x, y + 1.5, z + 0.005));
+  }
+
+  std::vector<std::pair<const char *, std::vector<Triangle<double>>>> inputs = {
+      {"plate", plate}};
+  for (Distribution distribution :
+       {Distribution::UNIFORM, Distribution::CLUSTERS, Distribution::GRID,
+        Distribution::OCTREE_WORST}) {
+    inputs.emplace_back(distribution_name(distribution),
+                        generate_triangles<double>(distribution, 1000, 7));
+  }
+
+  for (auto &[name, input] : inputs) {
+    for (size_t i = 0; i < input.size(); ++i)
+      input[i].id = i;
+
+    KdTree<double> tree(input);
+    std::multiset<std::pair<uint32_t, uint32_t>> found, expected;
+    for (size_t leaf = 0; leaf < tree.leaf_count(); ++leaf) {
+      tree.for_each_overlap(leaf, [&](uint32_t one, uint32_t two) {
+        found.emplace(std::min(one, two), std::max(one, two));
+      });
+    }
+    for (uint32_t one = 0; one < input.size(); ++one) {
+      for (uint32_t two = one + 1; two < input.size(); ++two) {
+        if (tree.get_box(one).overlaps(tree.get_box(two)))
+          expected.emplace(one, two);
+      }
+    }
+
+    EXPECT_EQ(found, expected) << name;
+    EXPECT_GT(tree.leaf_count(), 1u) << name;
+  }
+}
+
+TEST(TestClassBVH8, MasksMatchScalar) {
+  std::mt19937 random(5);
+  std::uniform_real_distribution<float> coordinate(-10.0f, 10.0f);
+  const BVH8Masks &masks = bvh8_masks();
+
+  for (int round = 0; round < 200; ++round) {
+    BVH8Node node;
+    for (int k = 0; k < BVH8Node::width; ++k) {
+      for (int axis = 0; axis < 3; ++axis) {
+        float one = coordinate(random), two = coordinate(random);
+        node.lower[axis][k] = std::min(one, two);
+        node.upper[axis][k] = std::max(one, two);
+      }
+      node.child[k] = k;
+      node.last[k] = k * 10;
+    }
+
+    BVH8BoxQuery box;
+    BVH8RayQuery ray;
+    for (int axis = 0; axis < 3; ++axis) {
+      float one = coordinate(random), two = coordinate(random);
+      box.lower[axis] = std::min(one, two);
+      box.upper[axis] = std::max(one, two);
+      ray.origin[axis] = coordinate(random);
+      ray.inverse[axis] = 1 / coordinate(random);
+    }
+    box.after = round % 80 - 5;
+    ray.from = 0;
+    ray.to = round % 2 == 0 ? 1.0f : 1e30f;
+
+    EXPECT_EQ(masks.box(node, box), bvh8_box_mask_scalar(node, box));
+    EXPECT_EQ(masks.ray(node, ray), bvh8_ray_mask_scalar(node, ray));
+  }
+}
+
+TEST(TestClassBVH8, QueriesMatchAllLeaves) {
+  for (Distribution distribution :
+       {Distribution::UNIFORM, Distribution::CLUSTERS, Distribution::GRID}) {
+    std::vector<Triangle<double>> input =
+        generate_triangles<double>(distribution, 1000, 9);
+    BVH8<double> bvh(input, 1);
+    std::vector<Triangle<double>> &leaves = bvh.get_leaves();
+    ASSERT_EQ(leaves.size(), input.size());
+    EXPECT_LT(bvh.node_count(), leaves.size() / 2);
+
+    // Float boxes are rounded outwards, so queries find at least the leaves
+    // whose boxes overlap in double precision.
+    for (uint32_t leaf = 0; leaf < leaves.size(); leaf += 7) {
+      std::set<uint32_t> found, expected;
+      bvh.for_each_overlap(leaf, [&](uint32_t other) {
+        EXPECT_GT(other, leaf);
+        EXPECT_TRUE(found.insert(other).second);
+      });
+      for (uint32_t other = leaf + 1; other < leaves.size(); ++other) {
+        if (bvh.get_leaf_box(leaf).overlaps(bvh.get_leaf_box(other)))
+          expected.insert(other);
+      }
+      EXPECT_TRUE(std::includes(found.begin(), found.end(), expected.begin(),
+                                expected.end()))
+          << distribution_name(distribution);
+    }
+
+    // A ray along x through the middle of the scene and the triangles it
+    // meets, by the boxes of the leaves.
+    Point<double> origin = leaves[leaves.size() / 2].get_a();
+    origin.x -= 1000;
+    Vector<double> direction{1, 0, 0};
+    std::set<uint32_t> found, expected;
+    bvh.for_each_ray_overlap(origin, direction, 0.0, 2000.0,
+                             [&](uint32_t leaf) { found.insert(leaf); });
+    for (uint32_t leaf = 0; leaf < leaves.size(); ++leaf) {
+      const Box<double> &box = bvh.get_leaf_box(leaf);
+      if (box.lower[1] <= origin.y && origin.y <= box.upper[1] &&
+          box.lower[2] <= origin.z && origin.z <= box.upper[2])
+        expected.insert(leaf);
+    }
+    EXPECT_FALSE(expected.empty()) << distribution_name(distribution);
+    EXPECT_TRUE(std::includes(found.begin(), found.end(), expected.begin(),
+                              expected.end()))
+        << distribution_name(distribution);
+
+    // Triangle queries give exactly the kernel's answer.
+    for (int k = 0; k < 20; ++k) {
+      Triangle<double> query = input[k * 37];
+      std::set<uint32_t> hit, all;
+      bvh.for_each_intersecting(query, [&](uint32_t leaf) { hit.insert(leaf); });
+      for (uint32_t leaf = 0; leaf < leaves.size(); ++leaf) {
+        if (check_intersection(query, leaves[leaf]))
+          all.insert(leaf);
+      }
+      EXPECT_EQ(hit, all) << distribution_name(distribution);
+    }
+  }
+}
+
+TEST(TestClassCompactBVH, QueriesMatchAllLeaves) {
+  // Tiny triangles far from the origin, where a float step is coarse.
+  std::vector<Triangle<double>> far;
+  std::mt19937 random(3);
+  std::uniform_real_distribution<double> offset(0.0, 0.5);
+  for (int i = 0; i < 500; ++i) {
+    double x = 1e4 + offset(random), y = -1e4 + offset(random),
+           z = offset(random);
+    far.emplace_back(Point(x, y, z), Point(x + 1e-3, y, z),
+                     Point(x, y + 1e-3, z + 1e-3));
+  }
+
+  std::vector<std::pair<const char *, std::vector<Triangle<double>>>> inputs = {
+      {"far", far}};
+  for (Distribution distribution :
+       {Distribution::UNIFORM, Distribution::CLUSTERS, Distribution::GRID}) {
+    inputs.emplace_back(distribution_name(distribution),
+                        generate_triangles<double>(distribution, 1000, 9));
+  }
+
+  for (auto &[name, input] : inputs) {
+    CompactBVH<double> bvh(input, 1);
+    ASSERT_EQ(bvh.size(), input.size());
+
+    // Quantized boxes contain the exact ones, so queries find at least the
+    // leaves whose boxes overlap in double precision, each once.
+    for (uint32_t leaf = 0; leaf < bvh.size(); ++leaf) {
+      std::set<uint32_t> found, expected;
+      bvh.for_each_overlap(leaf, [&](uint32_t other) {
+        EXPECT_GT(other, leaf);
+        EXPECT_TRUE(found.insert(other).second);
+      });
+      for (uint32_t other = leaf + 1; other < bvh.size(); ++other) {
+        if (bvh.get_leaf_box(leaf).overlaps(bvh.get_leaf_box(other)))
+          expected.insert(other);
+      }
+      ASSERT_TRUE(std::includes(found.begin(), found.end(), expected.begin(),
+                                expected.end()))
+          << name << " leaf " << leaf;
+    }
+
+    std::set<uint32_t> all;
+    bvh.for_each_box_overlap(bvh.get_leaf_box(0),
+                             [&](uint32_t leaf) { all.insert(leaf); });
+    EXPECT_TRUE(all.count(0)) << name;
+  }
+}
+
+// Heap allocations so far, counted by src/alloc_hook.cpp.
+uint64_t allocations() {
+  uint64_t count = 0;
+  for (const auto &slot : stats::alloc_slots)
+    count += slot.count.load();
+  return count;
+}
+
+TEST(TestClassAllocations, NarrowPhaseDoesNotAllocate) {
+  ASSERT_TRUE(stats::alloc_tracked());
+
+  size_t found = 0;
+  for (Distribution distribution : all_distributions) {
+    std::vector<Triangle<double>> input =
+        generate_triangles<double>(distribution, 200, 7);
+
+    uint64_t before = allocations();
+    for (size_t i = 0; i < input.size(); ++i) {
+      for (size_t j = i + 1; j < input.size(); ++j) {
+        found += check_intersection<Kernel::INTERVALS>(input[i], input[j]);
+        found += check_intersection<Kernel::ORIENTATION>(input[i], input[j]);
+      }
+    }
+    EXPECT_EQ(allocations(), before) << distribution_name(distribution);
+  }
+  EXPECT_GT(found, 0u);
+
+  // An octree cell takes its lists from the arena of the worker.
+  std::vector<Triangle<double>> input =
+      generate_triangles<double>(Distribution::CLUSTERS, 200, 7);
+  BoundingBox<double> cell(input);
+  Arena arena;
+  size_t pairs = 0;
+
+  uint64_t before = allocations();
+  for (int run = 0; run < 2; ++run) {
+    cell.for_each_owned_intersection(
+        [&](const Triangle<double> &, const Triangle<double> &) { ++pairs; },
+        arena.resource());
+    arena.release();
+  }
+  EXPECT_EQ(allocations(), before);
+  EXPECT_GT(pairs, 0u);
+}
+
+TEST(TestClassUnionFind, TestOperations) {
+  ConcurrentUnionFind components(6);
+
+  components.unite(4, 5);
+  components.unite(1, 4);
+  components.unite(2, 3);
+
+  EXPECT_EQ(components.find(5), 1);
+  EXPECT_EQ(components.same(1, 5), 1);
+  EXPECT_EQ(components.same(2, 3), 1);
+  EXPECT_EQ(components.same(1, 2), 0);
+  EXPECT_EQ(components.find(0), 0);
+}
+
+TEST(TestClassUnionFind, TestConcurrentUnite) {
+  const size_t size = 1 << 14;
+  ConcurrentUnionFind components(size);
+
+  // Even and odd elements form two chains, united in arbitrary order.
+  parallel_for(size - 2, 4, [&](size_t i, size_t) {
+    components.unite((i * 7919) % (size - 2) + 2, (i * 7919) % (size - 2));
+  });
+
+  for (size_t i = 0; i < size; ++i)
+    EXPECT_EQ(components.find(i), i % 2);
+}
+
+TEST(TestClassParallel, ParseThreads) {
+  EXPECT_EQ(parse_threads("0"), size_t{0});
+  EXPECT_EQ(parse_threads("16"), size_t{16});
+
+  for (const char *text :
+       {"", "x", "-1", "2x", " 2", "99999999999999999999999"})
+    EXPECT_EQ(parse_threads(text), std::nullopt) << text;
+}
+
+TEST(TestClassTrace, WorkersReuseBuffers) {
+  trace::enable();
+  { trace::Span span("test"); }
+
+  // Every call starts three new threads, which take over the buffers of the
+  // threads of the previous call.
+  for (int call = 0; call < 20; ++call)
+    parallel_for(64, 4, [](size_t, size_t) {});
+
+  std::lock_guard lock(trace::buffers_mutex);
+  EXPECT_LE(trace::buffers.size(), 4u);
+  for (size_t tid = 0; tid < trace::buffers.size(); ++tid)
+    EXPECT_EQ(trace::buffers[tid]->tid, tid);
+}
+
+// Output of write_ids for ids {0, 2, 3, 4, 9} of 11 in format.
+std::string ids_output(IdFormat format, bool background) {
+  std::FILE *file = std::tmpfile();
+  {
+    BufferedWriter writer(file, 4, background);
+    write_ids(writer, 11, format, [](size_t i) {
+      return i == 0 || (i >= 2 && i <= 4) || i == 9;
+    });
+  }
+
+  std::string result(std::ftell(file), '\0');
+  std::rewind(file);
+  EXPECT_EQ(std::fread(result.data(), 1, result.size(), file), result.size());
+  std::fclose(file);
+  return result;
+}
+
+TEST(TestClassOutput, TestIdFormats) {
+  for (bool background : {false, true}) {
+    EXPECT_EQ(ids_output(IdFormat::LIST, background), "0\n2\n3\n4\n9\n");
+    EXPECT_EQ(ids_output(IdFormat::RANGES, background), "0\n2-4\n9\n");
+    EXPECT_EQ(ids_output(IdFormat::COUNT, background), "5\n");
+    EXPECT_EQ(ids_output(IdFormat::BITMAP, background),
+              std::string("\x1d\x02", 2));
+  }
+}
+
+TEST(TestClassGenerator, TestSeed) {
+  for (Distribution distribution : all_distributions) {
+    TriangleGenerator gen1(distribution, 100, 7);
+    TriangleGenerator gen2(distribution, 100, 7);
+    TriangleGenerator gen3(distribution, 100, 8);
+
+    bool same_as_other_seed = true;
+    for (size_t i = 0; i < 100; ++i) {
+      std::array<double, 9> coordinates = gen1.next();
+      EXPECT_EQ(coordinates, gen2.next());
+      same_as_other_seed &= coordinates == gen3.next();
+    }
+
+    if (distribution != Distribution::GRID) {
+      EXPECT_FALSE(same_as_other_seed) << distribution_name(distribution);
+    }
+  }
+}
+
+TEST(TestClassGenerator, TestDegenerateTypes) {
+  std::vector<Triangle<double>> triangles =
+      generate_triangles(Distribution::DEGENERATE, 300, 1);
+  size_t types[4] = {};
+
+  for (const auto &trg : triangles)
+    ++types[trg.get_type()];
+
+  EXPECT_EQ(triangles.size(), 300);
+  EXPECT_GT(types[Triangle<double>::POINT], 50);
+  EXPECT_GT(types[Triangle<double>::LINE], 50);
+  EXPECT_GT(types[Triangle<double>::TRIANGLE], 50);
+}
+
 int main(int argc, char **argv) {
   ::testing::InitGoogleTest(&argc, argv);
   return RUN_ALL_TESTS();
@@ -1,19 +1,110 @@
-#include "octotree.hpp"
-#include "visualizer/visualizer.hpp"
+#include "input.hpp"
+#include "intersections.hpp"
+#include "output.hpp"
+#include "stats.hpp"
+#include "trace.hpp"
+#include "union_find.hpp"
+#include "visualizer/loader.hpp"
+
+enum class Mode { IDS, PAIRS, COMPONENTS };
 
 void print_help() {
     std::cout << "Usage: triag [OPTIONS] < input_file\n\n"
               << "Options:\n"
-              << "  -v, --visualize   # Enable visualization mode\n"
-              << "  -h, --help        # Show this help message\n"
-              << "  --version         # Show version information\n\n"
+              << "  -v, --visualize      # Enable visualization mode\n"
+              << "  --pairs[=binary]     # Print intersecting pairs instead of ids\n"
+              << "  --components[=list]  # Print connected components of the\n"
+              << "                       # intersection graph (with members)\n"
+              << "  --format NAME        # Ids as list (default), ranges (a-b),\n"
+              << "                       # bitmap (binary) or count\n"
+              << "  --writer-thread      # Write output from a separate thread\n"
+              << "  --threads N          # Worker threads, 0 = all cores (default 1)\n"
+              << "  --engine NAME        # Broad phase: octotree (default), brute,\n"
+              << "                       # lbvh, bvtt, loose, kdtree, bvh8\n"
+              << "  --kernel NAME        # Triangle-triangle test: intervals\n"
+              << "                       # (default), orient\n"
+              << "  --stats[=FILE]       # Phase timings and work counters to\n"
+              << "                       # stderr or as JSON to FILE\n"
+              << "  --perf               # Add hardware counters (cycles, IPC,\n"
+              << "                       # cache and branch misses) to --stats\n"
+              << "  --trace FILE         # Chrome trace-event JSON of the run\n"
+              << "  -h, --help           # Show this help message\n"
+              << "  --version            # Show version information\n\n"
               << "Examples:\n"
               << "  triag < input.txt          # Calculation mode (default)\n"
-              << "  triag -v < input.txt       # Visualization mode with OpenGL\n";
+              << "  triag -v < input.txt       # Visualization mode with OpenGL\n"
+              << "  triag --pairs < input.txt  # One \"i j\" line per pair\n"
+              << "  triag --components < input.txt  # One \"id size\" line per component\n";
+}
+
+// Prints components of the intersection graph as "id size" lines, where id
+// is the smallest triangle of the component, optionally followed by
+// ": member member ...". Triangles intersecting nothing are skipped.
+void print_components(triangle::ConcurrentUnionFind &components,
+                      bool with_members, bool writer_thread) {
+  size_t count = components.size();
+  std::vector<size_t> sizes(count, 0);
+  for (size_t i = 0; i < count; ++i)
+    ++sizes[components.find(i)];
+
+  triangle::BufferedWriter writer(
+      stdout, triangle::BufferedWriter::default_capacity, writer_thread);
+
+  if (!with_members) {
+    for (size_t i = 0; i < count; ++i) {
+      if (sizes[i] < 2)
+        continue;
+
+      writer.write_uint(i);
+      writer.write_char(' ');
+      writer.write_uint(sizes[i]);
+      writer.write_char('\n');
+    }
+    return;
+  }
+
+  // Bucket triangles by component root: members of every component end up
+  // contiguous and sorted by id.
+  std::vector<size_t> offsets(count + 1, 0);
+  for (size_t i = 0; i < count; ++i)
+    offsets[i + 1] = offsets[i] + sizes[i];
+
+  std::vector<size_t> members(count);
+  std::vector<size_t> filled(offsets.begin(), offsets.end() - 1);
+  for (size_t i = 0; i < count; ++i)
+    members[filled[components.find(i)]++] = i;
+
+  for (size_t i = 0; i < count; ++i) {
+    if (sizes[i] < 2)
+      continue;
+
+    writer.write_uint(i);
+    writer.write_char(' ');
+    writer.write_uint(sizes[i]);
+    writer.write_char(':');
+    for (size_t k = offsets[i]; k < offsets[i + 1]; ++k) {
+      writer.write_char(' ');
+      writer.write_uint(members[k]);
+    }
+    writer.write_char('\n');
+  }
 }
 
 int main(int argc, char **argv) {
+  using namespace triangle;
+
   bool use_visualization = false;
+  Mode mode = Mode::IDS;
+  bool binary_pairs = false;
+  bool component_members = false;
+  IdFormat id_format = IdFormat::LIST;
+  bool format_given = false;
+  bool writer_thread = false;
+  SearchOptions options;
+  bool print_stats = false;
+  bool hardware_counters = false;
+  std::string stats_path;
+  std::string trace_path;
 
   for (int i = 1; i < argc; ++i) {
     std::string arg = argv[i];
@@ -22,6 +113,70 @@ int main(int argc, char **argv) {
       return 0;
     } else if (arg == "-v" || arg == "--visualize") {
       use_visualization = true;
+    } else if (arg == "--pairs" || arg == "--pairs=text") {
+      mode = Mode::PAIRS;
+    } else if (arg == "--pairs=binary") {
+      mode = Mode::PAIRS;
+      binary_pairs = true;
+    } else if (arg == "--components") {
+      mode = Mode::COMPONENTS;
+    } else if (arg == "--components=list") {
+      mode = Mode::COMPONENTS;
+      component_members = true;
+    } else if ((arg == "--format" && i + 1 < argc) ||
+               arg.rfind("--format=", 0) == 0) {
+      std::string name =
+          arg == "--format" ? argv[++i] : arg.substr(arg.find('=') + 1);
+      std::optional<IdFormat> format = parse_id_format(name);
+      if (!format) {
+        std::cerr << "Unknown format: " << name << "\n";
+        return 1;
+      }
+      id_format = *format;
+      format_given = true;
+    } else if (arg == "--writer-thread") {
+      writer_thread = true;
+    } else if ((arg == "--threads" && i + 1 < argc) ||
+               arg.rfind("--threads=", 0) == 0) {
+      std::string count =
+          arg == "--threads" ? argv[++i] : arg.substr(arg.find('=') + 1);
+      std::optional<size_t> threads = parse_threads(count);
+      if (!threads) {
+        std::cerr << "Invalid thread count: " << count << "\n";
+        return 1;
+      }
+      options.threads = *threads;
+    } else if ((arg == "--engine" && i + 1 < argc) ||
+               arg.rfind("--engine=", 0) == 0) {
+      std::string name =
+          arg == "--engine" ? argv[++i] : arg.substr(arg.find('=') + 1);
+      std::optional<Engine> engine = parse_engine(name);
+      if (!engine) {
+        std::cerr << "Unknown engine: " << name << "\n";
+        return 1;
+      }
+      options.engine = *engine;
+    } else if ((arg == "--kernel" && i + 1 < argc) ||
+               arg.rfind("--kernel=", 0) == 0) {
+      std::string name =
+          arg == "--kernel" ? argv[++i] : arg.substr(arg.find('=') + 1);
+      std::optional<Kernel> kernel = parse_kernel(name);
+      if (!kernel) {
+        std::cerr << "Unknown kernel: " << name << "\n";
+        return 1;
+      }
+      options.kernel = *kernel;
+    } else if (arg == "--perf") {
+      print_stats = hardware_counters = true;
+    } else if (arg == "--stats") {
+      print_stats = true;
+    } else if (arg.rfind("--stats=", 0) == 0) {
+      print_stats = true;
+      stats_path = arg.substr(arg.find('=') + 1);
+    } else if (arg == "--trace" && i + 1 < argc) {
+      trace_path = argv[++i];
+    } else if (arg.rfind("--trace=", 0) == 0) {
+      trace_path = arg.substr(arg.find('=') + 1);
     } else if (arg == "--version") {
       std::cout << "Triangles Intersection v2.0\n";
       return 0;
@@ -32,45 +187,96 @@ int main(int argc, char **argv) {
     }
   }
 
-  using namespace triangle;
+  if (use_visualization && mode != Mode::IDS) {
+    std::cerr << "Option --visualize cannot be combined with --pairs or "
+                 "--components\n";
+    return 1;
+  }
+
+  if (format_given && (use_visualization || mode != Mode::IDS)) {
+    std::cerr << "Option --format applies only to the list of ids\n";
+    return 1;
+  }
+
   using PointTy = double;
 
-  std::vector<Triangle<PointTy>> input;
-  size_t triag_num = 0;
-  std::cin >> triag_num;
+  if (print_stats)
+    stats::enable();
 
-  for (size_t i = 0; i < triag_num; ++i) {
-    PointTy x1 = 0, y1 = 0, z1 = 0;
-    PointTy x2 = 0, y2 = 0, z2 = 0;
-    PointTy x3 = 0, y3 = 0, z3 = 0;
+  if (hardware_counters && !stats::enable_hardware()) {
+    std::cerr << "Warning: hardware counters are unavailable: "
+              << perf::error() << "\n";
+  }
 
-    std::cin >> x1 >> y1 >> z1 >> x2 >> y2 >> z2 >> x3 >> y3 >> z3;
+  if (!trace_path.empty())
+    trace::enable();
 
-    Triangle<PointTy> triangle(x1, y1, z1, x2, y2, z2, x3, y3, z3);
-    triangle.id = i;
-    input.push_back(triangle);
+  std::vector<Triangle<PointTy>> input;
+  {
+    stats::Phase phase("parse");
+    input = read_triangles<PointTy>(std::cin);
   }
 
-  Octotree<PointTy> octotree(input, calculate_octotree_depth(triag_num));
-  octotree.divide_tree();
+  size_t triag_num = input.size();
+  options.threads = resolve_threads(options.threads);
+  int status = 0;
 
-  std::map<size_t, size_t> intersections;
-  std::deque<BoundingBox<PointTy>> octotree_cells = octotree.get_cells();
+  if (mode == Mode::PAIRS) {
+    // One writer per thread; each buffer is flushed whole, so lines of
+    // different threads never interleave.
+    std::deque<PairWriter> writers;
+    for (size_t i = 0; i < options.threads; ++i)
+      writers.emplace_back(stdout, binary_pairs, writer_thread);
 
-  for (auto it : octotree_cells) {
-    std::vector<Triangle<PointTy>> cur_cell = it.get_trg_in_cell();
-    it.group_intersections(intersections);
-  }
+    find_intersecting_pairs(input, options,
+                            [&](const Triangle<PointTy> &one,
+                                const Triangle<PointTy> &two, size_t worker) {
+                              writers[worker].write(one.id, two.id);
+                            });
 
-  if (argc > 1) {
-    std::string arg = argv[1];
-    use_visualization = (arg == "--visualize" || arg == "-v");
-  }
+    stats::Phase phase("output");
+    for (auto &writer : writers)
+      writer.flush();
+  } else if (mode == Mode::COMPONENTS) {
+    ConcurrentUnionFind components(triag_num);
 
-  if (use_visualization) {
-    visualizer::runVisualizer(input, intersections);
+    find_intersecting_pairs(input, options,
+                            [&](const Triangle<PointTy> &one,
+                                const Triangle<PointTy> &two, size_t) {
+                              components.unite(one.id, two.id);
+                            });
+
+    stats::Phase phase("output");
+    print_components(components, component_members, writer_thread);
   } else {
-    for (auto it = intersections.begin(); it != intersections.end(); ++it)
-      std::cout << it->second << std::endl;
+    std::vector<std::atomic<bool>> intersecting =
+        find_intersecting(input, options);
+
+    if (use_visualization) {
+      std::map<size_t, size_t> intersections;
+      for (size_t i = 0; i < triag_num; ++i) {
+        if (intersecting[i].load(std::memory_order_relaxed))
+          intersections[i] = i;
+      }
+
+      stats::Phase phase("visualize");
+      if (!visualizer::loadAndRunVisualizer(input, intersections))
+        status = 1;
+    } else {
+      stats::Phase phase("output");
+      BufferedWriter writer(stdout, BufferedWriter::default_capacity,
+                            writer_thread);
+      write_ids(writer, triag_num, id_format, [&](size_t i) {
+        return intersecting[i].load(std::memory_order_relaxed);
+      });
+    }
   }
+
+  if (print_stats && !stats::report(stats_path))
+    status = 1;
+
+  if (!trace_path.empty() && !trace::write(trace_path))
+    status = 1;
+
+  return status;
 }
@@ -0,0 +1,91 @@
+#include "perf_counters.hpp"
+
+#include <cerrno>
+#include <cstring>
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+namespace triangle::perf {
+
+namespace {
+int fds[EVENT_NUM] = {-1, -1, -1, -1, -1};
+bool opened = false;
+std::string open_error;
+
+const uint64_t configs[EVENT_NUM] = {
+    PERF_COUNT_HW_CPU_CYCLES, PERF_COUNT_HW_INSTRUCTIONS,
+    PERF_COUNT_HW_CACHE_MISSES, PERF_COUNT_HW_BRANCH_INSTRUCTIONS,
+    PERF_COUNT_HW_BRANCH_MISSES};
+
+int open_event(uint64_t config) {
+  perf_event_attr attr{};
+  attr.size = sizeof(attr);
+  attr.type = PERF_TYPE_HARDWARE;
+  attr.config = config;
+  attr.exclude_kernel = 1;
+  attr.exclude_hv = 1;
+  attr.inherit = 1;
+  attr.read_format =
+      PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+
+  return static_cast<int>(
+      syscall(SYS_perf_event_open, &attr, 0 /* this process */,
+              -1 /* any cpu */, -1 /* no group */, 0));
+}
+
+void close_all() {
+  for (int &fd : fds) {
+    if (fd >= 0)
+      close(fd);
+    fd = -1;
+  }
+}
+} // namespace
+
+bool open() {
+  if (opened)
+    return true;
+
+  for (size_t i = 0; i < EVENT_NUM; ++i) {
+    fds[i] = open_event(configs[i]);
+    if (fds[i] < 0) {
+      open_error = std::string("perf_event_open(") + event_names[i] +
+                   "): " + std::strerror(errno);
+      if (errno == EACCES || errno == EPERM)
+        open_error += " (see /proc/sys/kernel/perf_event_paranoid)";
+      close_all();
+      return false;
+    }
+  }
+
+  opened = true;
+  open_error.clear();
+  return true;
+}
+
+bool available() { return opened; }
+
+const std::string &error() { return open_error; }
+
+Sample read() {
+  Sample sample;
+  if (!opened)
+    return sample;
+
+  for (size_t i = 0; i < EVENT_NUM; ++i) {
+    uint64_t data[3] = {}; // value, time enabled, time running
+    if (::read(fds[i], data, sizeof(data)) != sizeof(data))
+      return Sample{};
+
+    sample.values[i] =
+        data[2] == 0 ? 0
+                     : static_cast<uint64_t>(static_cast<double>(data[0]) *
+                                             data[1] / data[2]);
+  }
+
+  sample.valid = true;
+  return sample;
+}
+} // namespace triangle::perf
@@ -0,0 +1,189 @@
+#include "stats.hpp"
+
+#include <fstream>
+#include <iostream>
+#include <sys/resource.h>
+
+namespace triangle::stats {
+
+namespace {
+const char *type_names[4] = {"NONE", "POINT", "LINE", "TRIANGLE"};
+
+long peak_rss_kb() {
+  rusage usage{};
+  getrusage(RUSAGE_SELF, &usage);
+  return usage.ru_maxrss;
+}
+
+// Calls visit(name, slot) for the phases with allocations, and for the
+// time outside them as "other".
+template <typename SlotFn> void for_each_alloc_slot(SlotFn &&visit) {
+  for (size_t index = 0; index < alloc_slot_num; ++index) {
+    const PhaseAllocations &slot = alloc_slots[index];
+    const char *name = index == 0 ? "other" : slot.name.load();
+    if (name != nullptr && slot.count != 0)
+      visit(name, slot);
+  }
+}
+
+void print_text(std::ostream &out) {
+  out << "=== triag stats ===\n";
+  out << "phases (wall ms / cpu ms):\n";
+  for (const auto &phase : phases) {
+    out << "  " << phase.name << ": " << phase.wall_ms << " / " << phase.cpu_ms
+        << "\n";
+  }
+
+  if (hardware()) {
+    out << "hardware counters (cycles, instructions, IPC, cache misses, "
+           "branch misses, branch miss rate):\n";
+    for (const auto &phase : phases) {
+      const perf::Sample &hw = phase.hardware;
+      out << "  " << phase.name << ": " << hw.values[perf::CYCLES] << ", "
+          << hw.values[perf::INSTRUCTIONS] << ", " << hw.ipc() << ", "
+          << hw.values[perf::CACHE_MISSES] << ", "
+          << hw.values[perf::BRANCH_MISSES] << ", " << hw.branch_miss_rate()
+          << "\n";
+    }
+  } else if (!perf::error().empty()) {
+    out << "hardware counters: unavailable, " << perf::error() << "\n";
+  }
+
+  out << "triangles: " << tree.triangles << "\n"
+      << "cells: " << tree.cells << "\n"
+      << "duplication factor: " << tree.duplication_factor() << "\n"
+      << "candidate pairs: " << tree.candidate_pairs << "\n"
+      << "leaf size histogram:\n";
+  for (size_t k = 0; k < tree.leaf_histogram.size(); ++k) {
+    if (tree.leaf_histogram[k] != 0) {
+      out << "  [" << (k == 0 ? 0 : size_t{1} << k) << ", "
+          << (size_t{1} << (k + 1)) << "): " << tree.leaf_histogram[k] << "\n";
+    }
+  }
+
+  if (!counters_compiled) {
+    out << "work counters: disabled at build time (TRIAG_STATS=OFF)\n";
+  } else {
+    Counters counters = total_counters();
+    out << "pairs by type:\n";
+    for (size_t i = 1; i < 4; ++i) {
+      for (size_t j = i; j < 4; ++j) {
+        uint64_t pairs = counters.pair_types[i][j] +
+                         (i == j ? 0 : counters.pair_types[j][i]);
+        out << "  " << type_names[i] << "-" << type_names[j] << ": " << pairs
+            << "\n";
+      }
+    }
+
+    out << "triangle-triangle exits:\n";
+    for (size_t i = 0; i < TT_EXIT_NUM; ++i)
+      out << "  " << tt_exit_names[i] << ": " << counters.tt_exits[i] << "\n";
+
+    out << "duplicate pairs skipped: " << counters.duplicate_pairs << "\n";
+  }
+
+  if (!alloc_tracked()) {
+    out << "allocations: not tracked (TRIAG_ALLOC_STATS=OFF)\n";
+  } else {
+    out << "allocations by phase (count, bytes, peak live bytes):\n";
+    for_each_alloc_slot([&](const char *name, const PhaseAllocations &slot) {
+      out << "  " << name << ": " << slot.count << ", " << slot.bytes << ", "
+          << slot.peak << "\n";
+    });
+  }
+
+  out << "arena allocations: " << arena.served.count << " ("
+      << arena.served.bytes << " bytes), from the heap: " << arena.heap.count
+      << " (" << arena.heap.bytes << " bytes)\n";
+
+  out << "peak rss: " << peak_rss_kb() << " KB\n";
+}
+
+void print_json(std::ostream &out) {
+  out << "{\n  \"phases\": {";
+  for (size_t i = 0; i < phases.size(); ++i) {
+    out << (i ? ",\n" : "\n") << "    \"" << phases[i].name
+        << "\": {\"wall_ms\": " << phases[i].wall_ms
+        << ", \"cpu_ms\": " << phases[i].cpu_ms;
+
+    if (hardware()) {
+      const perf::Sample &hw = phases[i].hardware;
+      for (size_t k = 0; k < perf::EVENT_NUM; ++k)
+        out << ", \"" << perf::event_names[k] << "\": " << hw.values[k];
+      out << ", \"ipc\": " << hw.ipc()
+          << ", \"branch_miss_rate\": " << hw.branch_miss_rate();
+    }
+    out << "}";
+  }
+  out << "\n  },\n";
+
+  if (!hardware() && !perf::error().empty())
+    out << "  \"hardware_counters_error\": \"" << perf::error() << "\",\n";
+
+  out << "  \"triangles\": " << tree.triangles << ",\n"
+      << "  \"cells\": " << tree.cells << ",\n"
+      << "  \"duplication_factor\": " << tree.duplication_factor() << ",\n"
+      << "  \"candidate_pairs\": " << tree.candidate_pairs << ",\n"
+      << "  \"leaf_histogram\": [";
+  for (size_t k = 0; k < tree.leaf_histogram.size(); ++k)
+    out << (k ? ", " : "") << tree.leaf_histogram[k];
+  out << "],\n";
+
+  if (counters_compiled) {
+    Counters counters = total_counters();
+    out << "  \"pair_types\": {";
+    bool first = true;
+    for (size_t i = 1; i < 4; ++i) {
+      for (size_t j = i; j < 4; ++j) {
+        uint64_t pairs = counters.pair_types[i][j] +
+                         (i == j ? 0 : counters.pair_types[j][i]);
+        out << (first ? "" : ", ") << "\"" << type_names[i] << "-"
+            << type_names[j] << "\": " << pairs;
+        first = false;
+      }
+    }
+    out << "},\n  \"tt_exits\": {";
+    for (size_t i = 0; i < TT_EXIT_NUM; ++i) {
+      out << (i ? ", " : "") << "\"" << tt_exit_names[i]
+          << "\": " << counters.tt_exits[i];
+    }
+    out << "},\n  \"duplicate_pairs\": " << counters.duplicate_pairs << ",\n";
+  }
+
+  if (alloc_tracked()) {
+    out << "  \"allocations\": {";
+    bool first = true;
+    for_each_alloc_slot([&](const char *name, const PhaseAllocations &slot) {
+      out << (first ? "\n" : ",\n") << "    \"" << name
+          << "\": {\"count\": " << slot.count << ", \"bytes\": " << slot.bytes
+          << ", \"peak_bytes\": " << slot.peak << "}";
+      first = false;
+    });
+    out << "\n  },\n";
+  }
+
+  out << "  \"arena\": {\"allocations\": " << arena.served.count
+      << ", \"bytes\": " << arena.served.bytes
+      << ", \"heap_allocations\": " << arena.heap.count
+      << ", \"heap_bytes\": " << arena.heap.bytes << "},\n";
+
+  out << "  \"peak_rss_kb\": " << peak_rss_kb() << "\n}\n";
+}
+} // namespace
+
+bool report(const std::string &path) {
+  if (path.empty()) {
+    print_text(std::cerr);
+    return true;
+  }
+
+  std::ofstream out(path);
+  if (!out) {
+    std::cerr << "Error: cannot write stats to " << path << "\n";
+    return false;
+  }
+
+  print_json(out);
+  return true;
+}
+} // namespace triangle::stats
@@ -0,0 +1,54 @@
+#include "trace.hpp"
+
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+
+namespace triangle::trace {
+
+bool write(const std::string &path) {
+  std::ofstream out(path);
+  if (!out) {
+    std::cerr << "Error: cannot write trace to " << path << "\n";
+    return false;
+  }
+
+  std::lock_guard lock(buffers_mutex);
+
+  // Timestamps are relative to the first recorded span.
+  uint64_t origin = UINT64_MAX;
+  for (const auto &buffer : buffers) {
+    buffer->for_each([&](const Event &event) {
+      origin = std::min(origin, event.begin_ns);
+    });
+  }
+
+  // Nanoseconds as microseconds with all three decimals: the default
+  // precision of doubles rounds long runs to the millisecond.
+  out << std::fixed << std::setprecision(3);
+  out << "{\"displayTimeUnit\": \"ms\", \"traceEvents\": [\n";
+  bool first = true;
+
+  for (const auto &buffer : buffers) {
+    out << (first ? "" : ",\n")
+        << "{\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": 1, \"tid\": "
+        << buffer->tid << ", \"args\": {\"name\": \""
+        << (buffer->tid == 0 ? "main" : "worker") << " " << buffer->tid
+        << "\"}}";
+    first = false;
+
+    buffer->for_each([&](const Event &event) {
+      out << ",\n{\"name\": \"" << event.name
+          << "\", \"ph\": \"X\", \"pid\": 1, \"tid\": " << buffer->tid
+          << ", \"ts\": " << (event.begin_ns - origin) / 1e3
+          << ", \"dur\": " << (event.end_ns - event.begin_ns) / 1e3;
+      if (event.arg >= 0)
+        out << ", \"args\": {\"value\": " << event.arg << "}";
+      out << "}";
+    });
+  }
+
+  out << "\n]}\n";
+  return true;
+}
+} // namespace triangle::trace
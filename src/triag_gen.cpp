@@ -0,0 +1,94 @@
+#include "generator.hpp"
+#include "output.hpp"
+
+#include <string>
+
+// triag-gen: writes a synthetic dataset in the triag input format. Triangles
+// are generated and written one at a time, so the size is limited only by
+// the disk, not by memory.
+
+void print_help() {
+    std::cout << "Usage: triag-gen [OPTIONS] > output_file\n\n"
+              << "Options:\n"
+              << "  -d, --distribution NAME  # Dataset shape (default uniform)\n"
+              << "  -n, --count N            # Number of triangles (default 1000)\n"
+              << "  -s, --seed S             # Random seed (default 1)\n"
+              << "  -p, --precision P        # Digits after the point, default:\n"
+              << "                           # shortest exact representation\n"
+              << "  -o, --output FILE        # Write to FILE instead of stdout\n"
+              << "  -h, --help               # Show this help message\n\n"
+              << "Distributions:\n";
+
+    for (triangle::Distribution distribution : triangle::all_distributions)
+      std::cout << "  " << triangle::distribution_name(distribution) << "\n";
+
+    std::cout << "\nExamples:\n"
+              << "  triag-gen -d clusters -n 1000000 -s 7 > clusters.txt\n"
+              << "  triag-gen -d octree-worst -n 100000 | triag\n";
+}
+
+int main(int argc, char **argv) {
+  triangle::Distribution distribution = triangle::Distribution::UNIFORM;
+  size_t count = 1000;
+  uint64_t seed = 1;
+  int precision = -1;
+  std::string output_path;
+
+  for (int i = 1; i < argc; ++i) {
+    std::string arg = argv[i];
+    bool has_value = i + 1 < argc;
+
+    if (arg == "-h" || arg == "--help") {
+      print_help();
+      return 0;
+    } else if ((arg == "-d" || arg == "--distribution") && has_value) {
+      auto parsed = triangle::parse_distribution(argv[++i]);
+      if (!parsed) {
+        std::cerr << "Unknown distribution: " << argv[i] << "\n";
+        print_help();
+        return 1;
+      }
+      distribution = *parsed;
+    } else if ((arg == "-n" || arg == "--count") && has_value) {
+      count = static_cast<size_t>(std::stod(argv[++i]));
+    } else if ((arg == "-s" || arg == "--seed") && has_value) {
+      seed = std::stoull(argv[++i]);
+    } else if ((arg == "-p" || arg == "--precision") && has_value) {
+      precision = std::stoi(argv[++i]);
+    } else if ((arg == "-o" || arg == "--output") && has_value) {
+      output_path = argv[++i];
+    } else {
+      std::cerr << "Unknown option: " << arg << "\n";
+      print_help();
+      return 1;
+    }
+  }
+
+  std::FILE *file = stdout;
+  if (!output_path.empty()) {
+    file = std::fopen(output_path.c_str(), "wb");
+    if (!file) {
+      std::cerr << "Error: cannot open " << output_path << "\n";
+      return 1;
+    }
+  }
+
+  {
+    triangle::TriangleGenerator generator(distribution, count, seed);
+    triangle::BufferedWriter writer(file);
+
+    writer.write_uint(count);
+    writer.write_char('\n');
+
+    for (size_t i = 0; i < count; ++i) {
+      std::array<double, 9> coordinates = generator.next();
+      for (size_t k = 0; k < 9; ++k) {
+        writer.write_double(coordinates[k], precision);
+        writer.write_char(k % 3 == 2 ? '\n' : ' ');
+      }
+    }
+  }
+
+  if (file != stdout)
+    std::fclose(file);
+}
@@ -0,0 +1,64 @@
+#include "visualizer/loader.hpp"
+
+#include <cstdlib>
+#include <dlfcn.h>
+#include <filesystem>
+#include <string>
+
+namespace visualizer {
+
+namespace {
+// Directory of the running executable, empty if it cannot be determined.
+std::string executableDir() {
+  std::error_code error;
+  std::filesystem::path exe =
+      std::filesystem::read_symlink("/proc/self/exe", error);
+  if (error)
+    return {};
+
+  return exe.parent_path().string();
+}
+
+void *openPlugin() {
+  std::vector<std::string> candidates;
+
+  if (const char *env_path = std::getenv("TRIAG_VISUALIZER_PLUGIN"))
+    candidates.push_back(env_path);
+
+  std::string exe_dir = executableDir();
+  if (!exe_dir.empty())
+    candidates.push_back(exe_dir + "/" + plugin_name);
+
+  candidates.push_back(plugin_name);
+
+  for (const auto &path : candidates) {
+    if (void *handle = dlopen(path.c_str(), RTLD_NOW | RTLD_LOCAL))
+      return handle;
+  }
+
+  return nullptr;
+}
+} // namespace
+
+bool loadAndRunVisualizer(std::vector<triangle::Triangle<double>> &input,
+                          std::map<size_t, size_t> &intersections) {
+  void *handle = openPlugin();
+  if (!handle) {
+    std::cerr << "Error: visualization plugin " << plugin_name
+              << " was not found: " << dlerror() << "\n";
+    return false;
+  }
+
+  auto entry = reinterpret_cast<PluginEntry>(dlsym(handle, plugin_entry));
+  if (!entry) {
+    std::cerr << "Error: " << plugin_name << " does not export "
+              << plugin_entry << "\n";
+    dlclose(handle);
+    return false;
+  }
+
+  entry(input, intersections);
+  dlclose(handle);
+  return true;
+}
+} // namespace visualizer
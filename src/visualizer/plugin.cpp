@@ -0,0 +1,10 @@
+#include "visualizer/loader.hpp"
+#include "visualizer/visualizer.hpp"
+
+// Entry point of the visualizer plugin. The triag executable resolves it with
+// dlsym(), so it must keep C linkage and the PluginEntry signature.
+extern "C" void
+triag_run_visualizer(std::vector<triangle::Triangle<PointTy>> &input,
+                     std::map<size_t, size_t> &intersections) {
+  visualizer::runVisualizer(input, intersections);
+}